@@ -18,11 +18,25 @@ void Background::paint(Surface& s) {
 
 	bgmain.blit(s, 0, 0);
 
-	font.write(s, clock.getTime(),
+	paintedTime = clock.getTime();
+	font.write(s, paintedTime,
 			s.width() / 2, gmenu2x.bottomBarTextY,
 			Font::HAlignCenter, Font::VAlignMiddle);
 
-	battery.getIcon().blit(s, s.width() - 19, gmenu2x.bottomBarIconY);
+	paintedBattery = &battery.getIcon();
+	paintedBattery->blit(s, s.width() - 19, gmenu2x.bottomBarIconY);
+}
+
+SDL_Rect Background::takeDamage() {
+	if (clock.getTime() != paintedTime || &battery.getIcon() != paintedBattery) {
+		const int bottomBarHeight = gmenu2x.skinConfInt["bottomBarHeight"];
+		invalidate((SDL_Rect) {
+			0, static_cast<Sint16>(gmenu2x.resY - bottomBarHeight),
+			static_cast<Uint16>(gmenu2x.resX),
+			static_cast<Uint16>(bottomBarHeight)
+		});
+	}
+	return Layer::takeDamage();
 }
 
 bool Background::handleButtonPress(InputManager::Button button) {
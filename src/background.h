@@ -8,6 +8,8 @@
 #include "clock.h"
 #include "layer.h"
 
+#include <string>
+
 class GMenu2X;
 
 
@@ -20,6 +22,7 @@ public:
 
 	// Layer implementation:
 	virtual void paint(Surface& s);
+	virtual SDL_Rect takeDamage();
 	virtual bool handleButtonPress(InputManager::Button button);
 	virtual bool handleTouchscreen(Touchscreen& ts);
 
@@ -27,6 +30,10 @@ private:
 	GMenu2X& gmenu2x;
 	Battery battery;
 	Clock clock;
+
+	/** Status as shown when the background was last painted. */
+	std::string paintedTime;
+	OffscreenSurface const* paintedBattery = nullptr;
 };
 
 #endif // BACKGROUND_H
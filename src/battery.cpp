@@ -62,12 +62,13 @@ OffscreenSurface const& Battery::getIcon()
 		update();
 	}
 
-	return *sc.skinRes(iconPath);
+	return *sc.get(icon);
 }
 
 void Battery::update()
 {
 	unsigned short battlevel = getBatteryLevel();
+	std::string iconPath;
 	if (battlevel > 5) {
 		iconPath = "imgs/battery/ac.png";
 	} else {
@@ -75,4 +76,5 @@ void Battery::update()
 		ss << "imgs/battery/" << battlevel << ".png";
 		ss >> iconPath;
 	}
+	icon = sc.internSkinRes(iconPath);
 }
@@ -1,10 +1,9 @@
 #ifndef __BATTERY_H__
 #define __BATTERY_H__
 
-#include <string>
+#include "surfacecollection.h"
 
 class OffscreenSurface;
-class SurfaceCollection;
 
 
 /**
@@ -23,7 +22,7 @@ private:
 	void update();
 
 	SurfaceCollection& sc;
-	std::string iconPath;
+	SurfaceCollection::AssetId icon;
 	unsigned int lastUpdate;
 };
 
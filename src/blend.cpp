@@ -0,0 +1,462 @@
+// Various authors.
+// License: GPL version 2 or later.
+
+#include "blend.h"
+
+#include "debug.h"
+
+#include <SDL.h>
+
+#include <algorithm>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <emmintrin.h>
+#define BLEND_SSE2 1
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define BLEND_NEON 1
+#endif
+
+/**
+ * Position of the color components in a 16bpp pixel.
+ */
+struct Channels16 {
+	uint16_t mask[3];
+	uint8_t shift[3];
+};
+
+typedef void (*Fill16Row)(uint16_t *row, int w,
+		Channels16 const& ch, uint16_t fill, uint8_t alpha);
+typedef void (*Fill32Row)(uint32_t *row, int w, uint32_t fill, uint8_t alpha);
+
+struct Kernels {
+	const char *name;
+	Fill16Row fill16;
+	Fill32Row fill32;
+};
+
+
+// Portable kernels:
+
+static void fill16RowScalar(uint16_t *row, int w,
+		Channels16 const& ch, uint16_t fill, uint8_t alpha)
+{
+	for (int x = 0; x < w; x++) {
+		uint16_t& pixel = row[x];
+		uint32_t R = ((pixel & ch.mask[0]) * alpha >> 8) & ch.mask[0];
+		uint32_t G = ((pixel & ch.mask[1]) * alpha >> 8) & ch.mask[1];
+		uint32_t B = ((pixel & ch.mask[2]) * alpha >> 8) & ch.mask[2];
+		pixel = uint16_t(R | G | B) + fill;
+	}
+}
+
+static inline uint32_t mult8x4(uint32_t c, uint8_t a) {
+	return ((((c >> 8) & 0x00FF00FF) * a) & 0xFF00FF00)
+	     | ((((c & 0x00FF00FF) * a) & 0xFF00FF00) >> 8);
+}
+
+static void fill32RowScalar(uint32_t *row, int w, uint32_t fill, uint8_t alpha)
+{
+	for (int x = 0; x < w; x++) {
+		row[x] = mult8x4(row[x], alpha) + fill;
+	}
+}
+
+static const Kernels scalarKernels = {
+	"portable", fill16RowScalar, fill32RowScalar
+};
+
+
+// SSE2 kernels:
+
+#ifdef BLEND_SSE2
+
+/* Scaling a component c by alpha as ((c << s) * alpha >> 8) & (m << s) is
+ * the same as ((c * alpha) >> 8) << s, which fits in 16-bit lanes for
+ * components of up to 8 bits. */
+__attribute__((target("sse2")))
+static void fill16RowSSE2(uint16_t *row, int w,
+		Channels16 const& ch, uint16_t fill, uint8_t alpha)
+{
+	const __m128i a = _mm_set1_epi16(alpha);
+	const __m128i f = _mm_set1_epi16(fill);
+	__m128i masks[3], shifts[3];
+	for (int i = 0; i < 3; i++) {
+		masks[i] = _mm_set1_epi16(ch.mask[i] >> ch.shift[i]);
+		shifts[i] = _mm_cvtsi32_si128(ch.shift[i]);
+	}
+
+	int x = 0;
+	for (; x + 8 <= w; x += 8) {
+		__m128i *p = reinterpret_cast<__m128i *>(row + x);
+		const __m128i src = _mm_loadu_si128(p);
+		__m128i dst = _mm_setzero_si128();
+		for (int i = 0; i < 3; i++) {
+			__m128i c = _mm_and_si128(_mm_srl_epi16(src, shifts[i]), masks[i]);
+			c = _mm_srli_epi16(_mm_mullo_epi16(c, a), 8);
+			dst = _mm_or_si128(dst, _mm_sll_epi16(c, shifts[i]));
+		}
+		_mm_storeu_si128(p, _mm_add_epi16(dst, f));
+	}
+	fill16RowScalar(row + x, w - x, ch, fill, alpha);
+}
+
+__attribute__((target("sse2")))
+static void fill32RowSSE2(uint32_t *row, int w, uint32_t fill, uint8_t alpha)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i a = _mm_set1_epi16(alpha);
+	const __m128i f = _mm_set1_epi32(fill);
+
+	int x = 0;
+	for (; x + 4 <= w; x += 4) {
+		__m128i *p = reinterpret_cast<__m128i *>(row + x);
+		const __m128i src = _mm_loadu_si128(p);
+		__m128i lo = _mm_unpacklo_epi8(src, zero);
+		__m128i hi = _mm_unpackhi_epi8(src, zero);
+		lo = _mm_srli_epi16(_mm_mullo_epi16(lo, a), 8);
+		hi = _mm_srli_epi16(_mm_mullo_epi16(hi, a), 8);
+		_mm_storeu_si128(p, _mm_add_epi32(_mm_packus_epi16(lo, hi), f));
+	}
+	fill32RowScalar(row + x, w - x, fill, alpha);
+}
+
+static const Kernels sse2Kernels = {
+	"SSE2", fill16RowSSE2, fill32RowSSE2
+};
+
+#endif
+
+
+// NEON kernels:
+
+#ifdef BLEND_NEON
+
+static void fill16RowNEON(uint16_t *row, int w,
+		Channels16 const& ch, uint16_t fill, uint8_t alpha)
+{
+	const uint16x8_t a = vdupq_n_u16(alpha);
+	const uint16x8_t f = vdupq_n_u16(fill);
+	uint16x8_t masks[3];
+	int16x8_t shiftsLeft[3], shiftsRight[3];
+	for (int i = 0; i < 3; i++) {
+		masks[i] = vdupq_n_u16(ch.mask[i] >> ch.shift[i]);
+		shiftsLeft[i] = vdupq_n_s16(ch.shift[i]);
+		shiftsRight[i] = vdupq_n_s16(-ch.shift[i]);
+	}
+
+	int x = 0;
+	for (; x + 8 <= w; x += 8) {
+		const uint16x8_t src = vld1q_u16(row + x);
+		uint16x8_t dst = vdupq_n_u16(0);
+		for (int i = 0; i < 3; i++) {
+			uint16x8_t c = vandq_u16(vshlq_u16(src, shiftsRight[i]), masks[i]);
+			c = vshrq_n_u16(vmulq_u16(c, a), 8);
+			dst = vorrq_u16(dst, vshlq_u16(c, shiftsLeft[i]));
+		}
+		vst1q_u16(row + x, vaddq_u16(dst, f));
+	}
+	fill16RowScalar(row + x, w - x, ch, fill, alpha);
+}
+
+static void fill32RowNEON(uint32_t *row, int w, uint32_t fill, uint8_t alpha)
+{
+	const uint8x8_t a = vdup_n_u8(alpha);
+	const uint32x4_t f = vdupq_n_u32(fill);
+
+	int x = 0;
+	for (; x + 4 <= w; x += 4) {
+		const uint8x16_t src = vreinterpretq_u8_u32(vld1q_u32(row + x));
+		const uint8x8_t lo = vshrn_n_u16(vmull_u8(vget_low_u8(src), a), 8);
+		const uint8x8_t hi = vshrn_n_u16(vmull_u8(vget_high_u8(src), a), 8);
+		const uint32x4_t dst = vreinterpretq_u32_u8(vcombine_u8(lo, hi));
+		vst1q_u32(row + x, vaddq_u32(dst, f));
+	}
+	fill32RowScalar(row + x, w - x, fill, alpha);
+}
+
+static const Kernels neonKernels = {
+	"NEON", fill16RowNEON, fill32RowNEON
+};
+
+#endif
+
+
+// Dispatch:
+
+static const Kernels &selectKernels()
+{
+	const Kernels *kernels = &scalarKernels;
+#ifdef BLEND_SSE2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2")) {
+		kernels = &sse2Kernels;
+	}
+#endif
+#ifdef BLEND_NEON
+	// Compile time only: a build that targets NEON requires it anyway.
+	kernels = &neonKernels;
+#endif
+	DEBUG("Using %s blending kernels\n", kernels->name);
+	return *kernels;
+}
+
+static bool portableForced = false;
+
+static const Kernels &getKernels()
+{
+	static const Kernels &kernels = selectKernels();
+	return portableForced ? scalarKernels : kernels;
+}
+
+const char *blendKernelName()
+{
+	return getKernels().name;
+}
+
+void forcePortableBlendKernels(bool portable)
+{
+	portableForced = portable;
+}
+
+void fillAlpha16(uint8_t *pixels, int pitch, int w, int h,
+		SDL_PixelFormat const& format, uint16_t fill, uint8_t alpha)
+{
+	const Channels16 ch = {
+		{
+			static_cast<uint16_t>(format.Rmask),
+			static_cast<uint16_t>(format.Gmask),
+			static_cast<uint16_t>(format.Bmask),
+		}, {
+			format.Rshift, format.Gshift, format.Bshift,
+		}
+	};
+
+	/* The SIMD kernels compute in 16-bit lanes, which is exact only for
+	 * components of at most 8 bits; that covers every sane 16bpp format. */
+	Fill16Row fillRow = getKernels().fill16;
+	for (int i = 0; i < 3; i++) {
+		if ((ch.mask[i] >> ch.shift[i]) > 0xFF) {
+			fillRow = fill16RowScalar;
+		}
+	}
+
+	for (int y = 0; y < h; y++) {
+		fillRow(reinterpret_cast<uint16_t *>(pixels), w, ch, fill, alpha);
+		pixels += pitch;
+	}
+}
+
+void fillAlpha32(uint8_t *pixels, int pitch, int w, int h,
+		uint32_t fill, uint8_t alpha)
+{
+	Fill32Row fillRow = getKernels().fill32;
+	for (int y = 0; y < h; y++) {
+		fillRow(reinterpret_cast<uint32_t *>(pixels), w, fill, alpha);
+		pixels += pitch;
+	}
+}
+
+
+// Premultiplied alpha:
+
+/* Divides by 255 with rounding; exact for all products of two 8-bit values. */
+static inline uint32_t div255(uint32_t x)
+{
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+/* Multiplies all four 8-bit components by a / 255, with rounding. */
+static inline uint32_t scale8x4(uint32_t c, uint32_t a)
+{
+	uint32_t rb = (c & 0x00FF00FF) * a + 0x00800080;
+	uint32_t ag = ((c >> 8) & 0x00FF00FF) * a + 0x00800080;
+	rb = ((rb + ((rb >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+	ag = (ag + ((ag >> 8) & 0x00FF00FF)) & 0xFF00FF00;
+	return ag | rb;
+}
+
+void premultiplyAlpha(uint8_t *pixels, int pitch, int w, int h)
+{
+	for (int y = 0; y < h; y++) {
+		uint32_t *row = reinterpret_cast<uint32_t *>(pixels);
+		for (int x = 0; x < w; x++) {
+			const uint32_t a = row[x] >> 24;
+			if (a != 255) {
+				row[x] = (scale8x4(row[x], a) & 0x00FFFFFF) | (a << 24);
+			}
+		}
+		pixels += pitch;
+	}
+}
+
+/* The source pixels are premultiplied ARGB, so for every component,
+ * including alpha: dst' = src + dst * (255 - srcAlpha) / 255.
+ * Since a premultiplied component never exceeds the alpha, no component
+ * can overflow. */
+
+static void blitRowSameFormat(const uint32_t *src, uint32_t *dst, int w, uint32_t alpha)
+{
+	for (int x = 0; x < w; x++) {
+		uint32_t s = src[x];
+		if (alpha != 255) {
+			s = scale8x4(s, alpha);
+		}
+		const uint32_t sa = s >> 24;
+		if (sa == 255) {
+			dst[x] = s;
+		} else if (sa != 0) {
+			dst[x] = s + scale8x4(dst[x], 255 - sa);
+		}
+	}
+}
+
+static void blitRowRGB565(const uint32_t *src, uint16_t *dst, int w, uint32_t alpha)
+{
+	for (int x = 0; x < w; x++) {
+		uint32_t s = src[x];
+		if (alpha != 255) {
+			s = scale8x4(s, alpha);
+		}
+		const uint32_t sa = s >> 24;
+		if (sa == 0) {
+			continue;
+		}
+		uint32_t r = (s >> 16) & 0xFF, g = (s >> 8) & 0xFF, b = s & 0xFF;
+		if (sa != 255) {
+			const uint32_t ia = 255 - sa;
+			const uint32_t d = dst[x];
+			const uint32_t dr = (d >> 11) & 0x1F, dg = (d >> 5) & 0x3F, db = d & 0x1F;
+			r += div255(((dr << 3) | (dr >> 2)) * ia);
+			g += div255(((dg << 2) | (dg >> 4)) * ia);
+			b += div255(((db << 3) | (db >> 2)) * ia);
+		}
+		dst[x] = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+	}
+}
+
+template <typename Pixel>
+static void blitRowGeneric(const uint32_t *src, Pixel *dst, int w, uint32_t alpha,
+		SDL_PixelFormat const& format)
+{
+	const uint32_t masks[4] = { format.Amask, format.Rmask, format.Gmask, format.Bmask };
+	const uint8_t shifts[4] = { format.Ashift, format.Rshift, format.Gshift, format.Bshift };
+	const uint8_t losses[4] = { format.Aloss, format.Rloss, format.Gloss, format.Bloss };
+
+	for (int x = 0; x < w; x++) {
+		uint32_t s = src[x];
+		if (alpha != 255) {
+			s = scale8x4(s, alpha);
+		}
+		const uint32_t sa = s >> 24;
+		if (sa == 0) {
+			continue;
+		}
+		const uint32_t ia = 255 - sa;
+		const uint32_t d = dst[x];
+		uint32_t out = 0;
+		for (int c = 0; c < 4; c++) {
+			if (!masks[c]) {
+				continue;
+			}
+			uint32_t v = (s >> (24 - 8 * c)) & 0xFF;
+			if (ia) {
+				uint32_t dv = ((d & masks[c]) >> shifts[c]) << losses[c];
+				v += div255(dv * ia);
+			}
+			out |= ((v >> losses[c]) << shifts[c]) & masks[c];
+		}
+		dst[x] = out;
+	}
+}
+
+void blitPremultiplied(SDL_Surface *src, SDL_Rect const* srcRect,
+		SDL_Surface *dst, int x, int y, uint8_t alpha)
+{
+	if (alpha == 0) {
+		return;
+	}
+
+	// Clip the source rectangle against the source surface.
+	int sx = 0, sy = 0, w = src->w, h = src->h;
+	if (srcRect) {
+		sx = srcRect->x;
+		sy = srcRect->y;
+		w = srcRect->w;
+		h = srcRect->h;
+		if (sx < 0) { w += sx; x -= sx; sx = 0; }
+		if (sy < 0) { h += sy; y -= sy; sy = 0; }
+		w = std::min(w, src->w - sx);
+		h = std::min(h, src->h - sy);
+	}
+
+	// Clip against the destination's clipping rectangle.
+	SDL_Rect const& clip = dst->clip_rect;
+	if (x < clip.x) { w -= clip.x - x; sx += clip.x - x; x = clip.x; }
+	if (y < clip.y) { h -= clip.y - y; sy += clip.y - y; y = clip.y; }
+	w = std::min(w, clip.x + clip.w - x);
+	h = std::min(h, clip.y + clip.h - y);
+	if (w <= 0 || h <= 0) {
+		return;
+	}
+
+	if (SDL_MUSTLOCK(src) && SDL_LockSurface(src) < 0) {
+		return;
+	}
+	if (SDL_MUSTLOCK(dst) && SDL_LockSurface(dst) < 0) {
+		if (SDL_MUSTLOCK(src)) {
+			SDL_UnlockSurface(src);
+		}
+		return;
+	}
+
+	SDL_PixelFormat const& sf = *src->format;
+	SDL_PixelFormat const& df = *dst->format;
+	const uint8_t *srcRow = static_cast<const uint8_t *>(src->pixels)
+			+ sy * src->pitch + sx * 4;
+	uint8_t *dstRow = static_cast<uint8_t *>(dst->pixels)
+			+ y * dst->pitch + x * df.BytesPerPixel;
+
+	if (df.BytesPerPixel == 4 && df.Rmask == sf.Rmask
+			&& df.Gmask == sf.Gmask && df.Bmask == sf.Bmask) {
+		// ARGB to XRGB8888 or ARGB8888.
+		for (int row = 0; row < h; row++) {
+			blitRowSameFormat(reinterpret_cast<const uint32_t *>(srcRow),
+					reinterpret_cast<uint32_t *>(dstRow), w, alpha);
+			srcRow += src->pitch;
+			dstRow += dst->pitch;
+		}
+	} else if (df.BytesPerPixel == 2 && df.Rmask == 0xF800
+			&& df.Gmask == 0x07E0 && df.Bmask == 0x001F) {
+		// ARGB to RGB565.
+		for (int row = 0; row < h; row++) {
+			blitRowRGB565(reinterpret_cast<const uint32_t *>(srcRow),
+					reinterpret_cast<uint16_t *>(dstRow), w, alpha);
+			srcRow += src->pitch;
+			dstRow += dst->pitch;
+		}
+	} else if (df.BytesPerPixel == 4 || df.BytesPerPixel == 2) {
+		for (int row = 0; row < h; row++) {
+			if (df.BytesPerPixel == 4) {
+				blitRowGeneric(reinterpret_cast<const uint32_t *>(srcRow),
+						reinterpret_cast<uint32_t *>(dstRow), w, alpha, df);
+			} else {
+				blitRowGeneric(reinterpret_cast<const uint32_t *>(srcRow),
+						reinterpret_cast<uint16_t *>(dstRow), w, alpha, df);
+			}
+			srcRow += src->pitch;
+			dstRow += dst->pitch;
+		}
+	} else {
+		ERROR("Blitting to %d bpp surfaces is not supported\n", df.BitsPerPixel);
+	}
+
+	if (SDL_MUSTLOCK(dst)) {
+		SDL_UnlockSurface(dst);
+	}
+	if (SDL_MUSTLOCK(src)) {
+		SDL_UnlockSurface(src);
+	}
+}
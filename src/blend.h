@@ -0,0 +1,70 @@
+// Various authors.
+// License: GPL version 2 or later.
+
+#ifndef BLEND_H
+#define BLEND_H
+
+#include <cstdint>
+
+struct SDL_PixelFormat;
+struct SDL_Rect;
+struct SDL_Surface;
+
+/**
+ * Pixel blending kernels. Each kernel has a portable implementation and,
+ * where the CPU supports it, a SIMD one (SSE2 on x86, NEON on ARM). The
+ * implementation is chosen on first use: SSE2 is detected at runtime, but
+ * NEON is used only if the build targets it (-mfpu=neon or AArch64), since
+ * the NEON kernels cannot be compiled otherwise. All implementations
+ * produce bit-identical results.
+ */
+
+/**
+ * Blends a rectangle of 16bpp pixels towards a fill color:
+ *   pixel' = pixel * alpha / 256 + fill
+ * per color component, rounding down. The fill color must already be
+ * multiplied by the fill alpha, and alpha is the inverse of the fill alpha.
+ * The alpha channel of the pixels, if any, is replaced by the one in fill.
+ */
+void fillAlpha16(uint8_t *pixels, int pitch, int w, int h,
+		SDL_PixelFormat const& format, uint16_t fill, uint8_t alpha);
+
+/**
+ * Blends a rectangle of 32bpp pixels with 8 bits per component towards a
+ * fill color; see fillAlpha16(). All four components are blended alike.
+ */
+void fillAlpha32(uint8_t *pixels, int pitch, int w, int h,
+		uint32_t fill, uint8_t alpha);
+
+/**
+ * Returns the name of the implementation that fillAlpha16() and
+ * fillAlpha32() use, such as "SSE2".
+ */
+const char *blendKernelName();
+
+/**
+ * Makes fillAlpha16() and fillAlpha32() use the portable implementation if
+ * portable is true, or the one chosen for the CPU otherwise. This is for
+ * comparing the implementations; it must not be called while another thread
+ * is blending.
+ */
+void forcePortableBlendKernels(bool portable);
+
+/**
+ * Converts a rectangle of 32bpp ARGB pixels to premultiplied alpha in place:
+ * each color component is multiplied by the pixel's alpha.
+ */
+void premultiplyAlpha(uint8_t *pixels, int pitch, int w, int h);
+
+/**
+ * Blends a premultiplied 32bpp ARGB surface onto a 16bpp or 32bpp surface,
+ * the equivalent of SDL_BlitSurface() with per-pixel alpha. The source is
+ * additionally faded by the given global alpha, without modifying it.
+ * @param srcRect Part of the source to draw, or nullptr for all of it.
+ * @param x,y Position of the drawn part in the destination; the drawing is
+ *            clipped against the destination's clipping rectangle.
+ */
+void blitPremultiplied(SDL_Surface *src, SDL_Rect const* srcRect,
+		SDL_Surface *dst, int x, int y, uint8_t alpha);
+
+#endif
@@ -0,0 +1,87 @@
+// Various authors.
+// License: GPL version 2 or later.
+
+// Times the fill kernels of blend.h against their portable implementation
+// on a full 800x480 screen, and checks that both give identical results.
+// Usage: gmenu2x-blendbench [iterations]
+
+#include "blend.h"
+
+#include <SDL.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+static const int WIDTH = 800, HEIGHT = 480;
+
+/* Blends the pixels with every alpha value in turn, like dimming the screen
+ * repeatedly, and returns the average time per pass in milliseconds. */
+template<typename Fill>
+static double run(vector<uint8_t> &pixels, unsigned int iterations, Fill fill)
+{
+	auto start = chrono::steady_clock::now();
+	for (unsigned int i = 0; i < iterations; i++) {
+		fill(pixels.data(), static_cast<uint8_t>(i * 7 + 1));
+	}
+	chrono::duration<double, milli> elapsed =
+			chrono::steady_clock::now() - start;
+	return elapsed.count() / iterations;
+}
+
+/* Runs a kernel both ways on the same random pixels. Returns false if the
+ * results differ. */
+template<typename Fill>
+static bool compare(const char *name, size_t bytesPerPixel,
+		unsigned int iterations, Fill fill)
+{
+	vector<uint8_t> portable(WIDTH * HEIGHT * bytesPerPixel);
+	for (uint8_t &byte : portable) {
+		byte = static_cast<uint8_t>(rand());
+	}
+	vector<uint8_t> selected = portable;
+
+	forcePortableBlendKernels(true);
+	const double portableMs = run(portable, iterations, fill);
+	forcePortableBlendKernels(false);
+	const double selectedMs = run(selected, iterations, fill);
+
+	const bool same = portable == selected;
+	printf("%s: portable %.3f ms, %s %.3f ms, %.2fx, results %s\n",
+			name, portableMs, blendKernelName(), selectedMs,
+			portableMs / selectedMs, same ? "identical" : "DIFFER");
+	return same;
+}
+
+int main(int argc, char *argv[]) {
+	const unsigned int iterations = argc > 1 ? atoi(argv[1]) : 200;
+	if (argc > 2 || iterations == 0) {
+		fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+		return 2;
+	}
+
+	SDL_PixelFormat rgb565;
+	memset(&rgb565, 0, sizeof(rgb565));
+	rgb565.BitsPerPixel = 16;
+	rgb565.BytesPerPixel = 2;
+	rgb565.Rmask = 0xF800;
+	rgb565.Gmask = 0x07E0;
+	rgb565.Bmask = 0x001F;
+	rgb565.Rshift = 11;
+	rgb565.Gshift = 5;
+
+	bool ok = compare("fillAlpha16 (RGB565)", 2, iterations,
+			[&rgb565](uint8_t *pixels, uint8_t alpha) {
+				fillAlpha16(pixels, WIDTH * 2, WIDTH, HEIGHT, rgb565,
+						0x0841, alpha);
+			});
+	ok = compare("fillAlpha32", 4, iterations,
+			[](uint8_t *pixels, uint8_t alpha) {
+				fillAlpha32(pixels, WIDTH * 4, WIDTH, HEIGHT,
+						0x20101008, alpha);
+			}) && ok;
+	return ok ? 0 : 1;
+}
@@ -265,12 +265,12 @@ void BrowseDialog::paint()
 		Surface *icon;
 		if (fl.isDirectory(i)) {
 			if (fl[i] == "..") {
-				icon = iconGoUp;
+				icon = iconGoUp.get();
 			} else {
-				icon = iconFolder;
+				icon = iconFolder.get();
 			}
 		} else {
-			icon = iconFile;
+			icon = iconFile.get();
 		}
 		icon->blit(s, 5, offsetY);
 		gmenu2x->font->write(s, fl[i], 24, offsetY + rowHeight / 2,
@@ -286,6 +286,6 @@ void BrowseDialog::paint()
 	}
 	s.clearClipRect();
 
-	gmenu2x->drawScrollBar(numRows,fl.size(), firstElement);
+	gmenu2x->drawScrollBar(s, numRows,fl.size(), firstElement);
 	s.flip();
 }
@@ -75,9 +75,9 @@ private:
 
 	bool ts_pressed;
 
-	OffscreenSurface *iconGoUp;
-	OffscreenSurface *iconFolder;
-	OffscreenSurface *iconFile;
+	std::shared_ptr<OffscreenSurface> iconGoUp;
+	std::shared_ptr<OffscreenSurface> iconFolder;
+	std::shared_ptr<OffscreenSurface> iconFile;
 
 	ButtonBox buttonBox;
 
@@ -102,6 +102,7 @@ bool ContextMenu::runAnimations()
 	if (fadeAlpha < 200) {
 		const long tickNow = SDL_GetTicks();
 		fadeAlpha = intTransition(0, 200, tickStart, 500, tickNow);
+		invalidate();
 	}
 	return fadeAlpha < 200;
 }
@@ -143,10 +144,12 @@ bool ContextMenu::handleButtonPress(InputManager::Button button) {
 		case InputManager::UP:
 			selected--;
 			if (selected < 0) selected = options.size() - 1;
+			invalidate(box);
 			break;
 		case InputManager::DOWN:
 			selected++;
 			if (selected >= static_cast<int>(options.size())) selected = 0;
+			invalidate(box);
 			break;
 		case InputManager::ACCEPT:
 			options[selected]->action();
@@ -167,6 +170,7 @@ bool ContextMenu::handleTouchscreen(Touchscreen &ts) {
 			dismiss();
 		} else if (ts.pressed()) {
 			selected = i;
+			invalidate(box);
 		}
 	} else {
 		if (ts.released()) {
@@ -0,0 +1,226 @@
+// Various authors.
+// License: GPL version 2 or later.
+
+// Times decoding the PNG images of a skin against decoding the same images
+// converted to QOI, and checks that both give identical surfaces.
+// Usage: gmenu2x-decodebench <skin directory> [iterations]
+
+#include "imageio.h"
+
+#include <SDL.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <string>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+static void findPNGs(string const& dir, vector<string> &paths)
+{
+	DIR *dirp = opendir(dir.c_str());
+	if (!dirp) return;
+	while (struct dirent *dptr = readdir(dirp)) {
+		if (dptr->d_name[0] == '.') continue;
+		const string path = dir + '/' + dptr->d_name;
+		struct stat st;
+		if (stat(path.c_str(), &st) < 0) continue;
+		const size_t len = strlen(dptr->d_name);
+		if (S_ISDIR(st.st_mode)) {
+			findPNGs(path, paths);
+		} else if (len > 4
+				&& strcasecmp(dptr->d_name + len - 4, ".png") == 0) {
+			paths.push_back(path);
+		}
+	}
+	closedir(dirp);
+}
+
+static void putBigEndian32(vector<uint8_t> &out, uint32_t v)
+{
+	out.push_back(v >> 24);
+	out.push_back(v >> 16);
+	out.push_back(v >> 8);
+	out.push_back(v);
+}
+
+/* Encodes a 32bpp ARGB surface as a QOI image (https://qoiformat.org/). */
+static vector<uint8_t> encodeQOI(SDL_Surface *s)
+{
+	vector<uint8_t> out = { 'q', 'o', 'i', 'f' };
+	putBigEndian32(out, s->w);
+	putBigEndian32(out, s->h);
+	out.push_back(4); // RGBA
+	out.push_back(0); // sRGB
+
+	uint8_t index[64][4] = {};
+	uint8_t prev[4] = { 0, 0, 0, 255 };
+	unsigned int run = 0;
+	for (int y = 0; y < s->h; y++) {
+		const uint32_t *row = reinterpret_cast<const uint32_t *>(
+				static_cast<uint8_t *>(s->pixels) + y * s->pitch);
+		for (int x = 0; x < s->w; x++) {
+			const uint8_t px[4] = {
+				uint8_t(row[x] >> 16), uint8_t(row[x] >> 8),
+				uint8_t(row[x]), uint8_t(row[x] >> 24),
+			};
+			if (!memcmp(px, prev, 4)) {
+				if (++run == 62) {
+					out.push_back(0xC0 | (run - 1));
+					run = 0;
+				}
+				continue;
+			}
+			if (run) {
+				out.push_back(0xC0 | (run - 1));
+				run = 0;
+			}
+
+			const int hash =
+					(px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) & 63;
+			if (!memcmp(index[hash], px, 4)) {
+				out.push_back(hash);
+			} else if (px[3] != prev[3]) {
+				out.insert(out.end(), { 0xFF, px[0], px[1], px[2], px[3] });
+			} else {
+				const int8_t dr = px[0] - prev[0];
+				const int8_t dg = px[1] - prev[1];
+				const int8_t db = px[2] - prev[2];
+				const int8_t drg = dr - dg, dbg = db - dg;
+				if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1
+						&& db >= -2 && db <= 1) {
+					out.push_back(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+				} else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7
+						&& dbg >= -8 && dbg <= 7) {
+					out.push_back(0x80 | (dg + 32));
+					out.push_back((drg + 8) << 4 | (dbg + 8));
+				} else {
+					out.insert(out.end(), { 0xFE, px[0], px[1], px[2] });
+				}
+			}
+			memcpy(index[hash], px, 4);
+			memcpy(prev, px, 4);
+		}
+	}
+	if (run) {
+		out.push_back(0xC0 | (run - 1));
+	}
+	out.insert(out.end(), { 0, 0, 0, 0, 0, 0, 0, 1 });
+	return out;
+}
+
+static bool samePixels(SDL_Surface *a, SDL_Surface *b)
+{
+	if (!a || !b || a->w != b->w || a->h != b->h) {
+		return false;
+	}
+	for (int y = 0; y < a->h; y++) {
+		if (memcmp(static_cast<uint8_t *>(a->pixels) + y * a->pitch,
+				static_cast<uint8_t *>(b->pixels) + y * b->pitch,
+				a->w * 4)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Loads all images the way skin images are loaded, premultiplied, and
+ * returns the average time per pass in milliseconds. */
+static double run(vector<string> const& paths, unsigned int iterations)
+{
+	auto start = chrono::steady_clock::now();
+	for (unsigned int i = 0; i < iterations; i++) {
+		for (string const& path : paths) {
+			SDL_FreeSurface(loadImageFile(path, true, true));
+		}
+	}
+	chrono::duration<double, milli> elapsed =
+			chrono::steady_clock::now() - start;
+	return elapsed.count() / iterations;
+}
+
+static size_t fileSize(string const& path)
+{
+	struct stat st;
+	return stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+int main(int argc, char *argv[]) {
+	const unsigned int iterations = argc > 2 ? atoi(argv[2]) : 10;
+	if (argc < 2 || argc > 3 || iterations == 0) {
+		fprintf(stderr, "Usage: %s <skin directory> [iterations]\n", argv[0]);
+		return 2;
+	}
+
+	vector<string> pngs, qois;
+	findPNGs(argv[1], pngs);
+	if (pngs.empty()) {
+		fprintf(stderr, "No PNG images found in %s\n", argv[1]);
+		return 1;
+	}
+
+	char tmpl[] = "/tmp/gmenu2x-decodebench.XXXXXX";
+	if (!mkdtemp(tmpl)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	const string tmpDir = tmpl;
+
+	// Convert every image and check that it decodes to the same pixels.
+	bool ok = true;
+	size_t pngBytes = 0, qoiBytes = 0;
+	for (size_t i = 0; i < pngs.size(); i++) {
+		SDL_Surface *png = loadImageFile(pngs[i]);
+		if (!png) {
+			fprintf(stderr, "Unable to load %s\n", pngs[i].c_str());
+			ok = false;
+			continue;
+		}
+		const string qoi = tmpDir + "/" + to_string(i) + ".qoi";
+		const vector<uint8_t> data = encodeQOI(png);
+		FILE *f = fopen(qoi.c_str(), "wb");
+		bool written = f
+				&& fwrite(data.data(), 1, data.size(), f) == data.size();
+		if (f && fclose(f) != 0) {
+			written = false;
+		}
+		if (!written) {
+			fprintf(stderr, "Unable to write %s\n", qoi.c_str());
+			SDL_FreeSurface(png);
+			ok = false;
+			break;
+		}
+		qois.push_back(qoi);
+		pngBytes += fileSize(pngs[i]);
+		qoiBytes += data.size();
+
+		SDL_Surface *pngPremultiplied = loadImageFile(pngs[i], true, true);
+		SDL_Surface *qoiPremultiplied = loadImageFile(qoi, true, true);
+		if (!samePixels(pngPremultiplied, qoiPremultiplied)) {
+			fprintf(stderr, "QOI decode of %s differs\n", pngs[i].c_str());
+			ok = false;
+		}
+		SDL_FreeSurface(png);
+		SDL_FreeSurface(pngPremultiplied);
+		SDL_FreeSurface(qoiPremultiplied);
+	}
+
+	if (ok) {
+		const double pngMs = run(pngs, iterations);
+		const double qoiMs = run(qois, iterations);
+		printf("%zu images: PNG %.1f ms (%zu KB), QOI %.1f ms (%zu KB), %.2fx\n",
+				pngs.size(), pngMs, pngBytes / 1024, qoiMs, qoiBytes / 1024,
+				pngMs / qoiMs);
+	}
+
+	for (string const& qoi : qois) {
+		unlink(qoi.c_str());
+	}
+	rmdir(tmpDir.c_str());
+	return ok ? 0 : 1;
+}
@@ -10,7 +10,7 @@ Dialog::Dialog(GMenu2X *gmenu2x) : gmenu2x(gmenu2x)
 
 void Dialog::drawTitleIcon(Surface& s, const std::string &icon, bool skinRes)
 {
-	Surface *i = NULL;
+	std::shared_ptr<OffscreenSurface> i;
 	if (!icon.empty()) {
 		if (skinRes)
 			i = gmenu2x->sc.skinRes(icon);
@@ -1,77 +1,410 @@
 #include "font.h"
 
 #include "debug.h"
+#include "gmenu2x.h"
 #include "surface.h"
 #include "utilities.h"
 
 #include <SDL.h>
 #include <SDL_ttf.h>
 #include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
 #include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /* TODO: Let the theme choose the font and font size */
 #define TTF_FONT "/usr/share/fonts/truetype/dejavu/DejaVuSansCondensed.ttf"
 #define TTF_FONT_SIZE 12
 
+/* Size of a glyph atlas block; glyphs larger than this get a block of their own. */
+#define ATLAS_BLOCK_SIZE 16384
+
+/* Default memory budget for rendered lines of text. */
+#define LINE_CACHE_BUDGET (256 * 1024)
+
+/* Identifies the bitmap font format; change it when the layout changes. */
+#define BITMAP_FONT_MAGIC "GM2XBMF1"
+
 using namespace std;
 
+/*
+ * The bitmap font file consists of a header, the path of the TrueType font,
+ * the glyph records sorted by character, the kerning pairs and finally the
+ * coverage maps of the glyphs. Everything is in native byte order: the file
+ * is a cache for this machine only.
+ */
+struct Font::BitmapHeader {
+	char magic[8];
+	Uint32 size;
+	Uint32 pathLength;
+	Sint64 ttfModified;
+	Uint64 ttfSize;
+	Sint32 lineSpacing, ascent;
+	Uint32 numGlyphs, numKerningPairs;
+};
+
+struct Font::BitmapGlyph {
+	Uint16 ch, w, h;
+	Sint16 minx, maxx, maxy, advance, reserved;
+	Uint32 offset; // of the coverage map, from the start of the file
+};
+
+struct Font::BitmapKerning {
+	Uint32 pair;
+	Sint32 delta;
+};
+
+static inline size_t align4(size_t n)
+{
+	return (n + 3) & ~(size_t) 3;
+}
+
+/**
+ * Decodes the UTF-8 sequence starting at text[pos] and advances pos past it.
+ * Like SDL_ttf, we only support the Basic Multilingual Plane; characters
+ * outside of it and malformed sequences are mapped to U+FFFD.
+ */
+static Uint16 decodeUTF8(const string &text, size_t &pos)
+{
+	const size_t len = text.length();
+	unsigned char c = text[pos++];
+	unsigned int ch, extra;
+
+	if (c < 0x80) {
+		return c;
+	} else if ((c & 0xE0) == 0xC0) {
+		ch = c & 0x1F;
+		extra = 1;
+	} else if ((c & 0xF0) == 0xE0) {
+		ch = c & 0x0F;
+		extra = 2;
+	} else {
+		while (pos < len && !isUTF8Starter(text[pos])) {
+			pos++;
+		}
+		return 0xFFFD;
+	}
+
+	for (; extra > 0; extra--) {
+		if (pos == len || isUTF8Starter(text[pos])) {
+			return 0xFFFD;
+		}
+		ch = (ch << 6) | (text[pos++] & 0x3F);
+	}
+	return ch;
+}
+
 unique_ptr<Font> Font::defaultFont()
 {
 	return unique_ptr<Font>(new Font(TTF_FONT, TTF_FONT_SIZE));
 }
 
 Font::Font(const std::string &path, unsigned int size)
+	: path(path)
+	, size(size)
 {
 	font = nullptr;
+	openFailed = false;
 	lineSpacing = 1;
+	ascent = 0;
+	bitmapData = nullptr;
+	bitmapSize = 0;
+	bitmapGlyphs = nullptr;
+	numBitmapGlyphs = 0;
+	bitmapDirty = false;
+	bitmapKerning = true;
+	textColor = { 0xff, 0xff, 0xff, 0xff };
+	outlineColor = { 0, 0, 0, 0xff };
+	outlineWidth = 1;
+	lineCacheSize = 0;
+	lineCacheBudget = LINE_CACHE_BUDGET;
+	lineCacheHits = lineCacheMisses = 0;
+
+	/* FreeType is only needed right away if there is no bitmap font yet. */
+	if (!loadBitmapFont()) {
+		openFont();
+	}
+}
+
+Font::~Font()
+{
+	DEBUG("Font line cache: %u hits, %u misses, %zu bytes in %zu lines\n",
+			lineCacheHits, lineCacheMisses, lineCacheSize, lineCache.size());
+	if (bitmapDirty) {
+		saveBitmapFont();
+	}
+	if (bitmapData) {
+		munmap(bitmapData, bitmapSize);
+	}
+	if (font) {
+		TTF_CloseFont(font);
+		TTF_Quit();
+	}
+}
+
+bool Font::openFont()
+{
+	if (font || openFailed) {
+		return font != nullptr;
+	}
+	openFailed = true;
 
 	/* Note: TTF_Init and TTF_Quit perform reference counting, so call them
 	 * both unconditionally for each font. */
 	if (TTF_Init() < 0) {
 		ERROR("Unable to init SDL_ttf library\n");
-		return;
+		return false;
 	}
 
 	font = TTF_OpenFont(path.c_str(), size);
 	if (!font) {
 		ERROR("Unable to open font\n");
 		TTF_Quit();
-		return;
+		return false;
 	}
 
+	openFailed = false;
 	lineSpacing = TTF_FontLineSkip(font);
+	ascent = TTF_FontAscent(font);
+	return true;
 }
 
-Font::~Font()
+string Font::getBitmapPath()
 {
-	if (font) {
-		TTF_CloseFont(font);
-		TTF_Quit();
+	char name[64];
+	snprintf(name, sizeof(name), "/fonts/%016zx-%u.bmf",
+			hash<string>()(path), size);
+	return GMenu2X::getHome() + name;
+}
+
+bool Font::loadBitmapFont()
+{
+	struct stat ttf;
+	if (stat(path.c_str(), &ttf) < 0) {
+		return false;
+	}
+
+	const string bitmapPath = getBitmapPath();
+	int fd = open(bitmapPath.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
 	}
+	struct stat st;
+	void *data = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(BitmapHeader)) {
+		data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+
+	/* Check that the bitmap font matches the font file and is intact. The
+	 * counts are checked before they are multiplied, so that the offsets
+	 * cannot wrap around on 32-bit systems. */
+	const size_t fileSize = st.st_size;
+	const Uint8 *bytes = static_cast<const Uint8 *>(data);
+	const BitmapHeader *header = static_cast<const BitmapHeader *>(data);
+	bool valid = memcmp(header->magic, BITMAP_FONT_MAGIC, 8) == 0
+			&& header->size == size
+			&& header->ttfModified == (Sint64) ttf.st_mtime
+			&& header->ttfSize == (Uint64) ttf.st_size
+			&& header->pathLength == path.length()
+			&& align4(path.length()) <= fileSize - sizeof(BitmapHeader);
+	const size_t glyphsOffset = sizeof(BitmapHeader) + align4(path.length());
+	valid = valid && header->numGlyphs
+			<= (fileSize - glyphsOffset) / sizeof(BitmapGlyph);
+	const size_t kerningOffset = glyphsOffset
+			+ (valid ? header->numGlyphs * sizeof(BitmapGlyph) : 0);
+	valid = valid && header->numKerningPairs
+			<= (fileSize - kerningOffset) / sizeof(BitmapKerning)
+			&& memcmp(bytes + sizeof(BitmapHeader), path.data(),
+					path.length()) == 0;
+	const BitmapGlyph *glyphTable =
+			reinterpret_cast<const BitmapGlyph *>(bytes + glyphsOffset);
+	for (Uint32 i = 0; valid && i < header->numGlyphs; i++) {
+		const BitmapGlyph &g = glyphTable[i];
+		valid = (i == 0 || glyphTable[i - 1].ch < g.ch)
+				&& g.offset <= fileSize
+				&& (size_t) g.w * g.h <= fileSize - g.offset;
+	}
+	if (!valid) {
+		DEBUG("Ignoring outdated bitmap font %s\n", bitmapPath.c_str());
+		munmap(data, fileSize);
+		return false;
+	}
+
+	bitmapData = data;
+	bitmapSize = fileSize;
+	bitmapGlyphs = glyphTable;
+	numBitmapGlyphs = header->numGlyphs;
+	lineSpacing = header->lineSpacing;
+	ascent = header->ascent;
+
+	const BitmapKerning *kerning =
+			reinterpret_cast<const BitmapKerning *>(bytes + kerningOffset);
+	bitmapKerning = false;
+	for (Uint32 i = 0; i < header->numKerningPairs; i++) {
+		kerningPairs[kerning[i].pair] = kerning[i].delta;
+		bitmapKerning |= kerning[i].delta != 0;
+	}
+
+	DEBUG("Loaded bitmap font %s with %u glyphs\n",
+			bitmapPath.c_str(), numBitmapGlyphs);
+	return true;
+}
+
+void Font::saveBitmapFont()
+{
+	struct stat ttf;
+	if (stat(path.c_str(), &ttf) < 0) {
+		return;
+	}
+
+	/* Gather the glyphs from the existing bitmap font as well as the ones
+	 * used this time, so the bitmap font only ever grows. */
+	map<Uint16, pair<BitmapGlyph, const Uint8 *>> entries;
+	const Uint8 *bitmapBytes = static_cast<const Uint8 *>(bitmapData);
+	for (unsigned int i = 0; i < numBitmapGlyphs; i++) {
+		const BitmapGlyph &g = bitmapGlyphs[i];
+		entries[g.ch] = make_pair(g, bitmapBytes + g.offset);
+	}
+	for (auto &it : glyphs) {
+		const Glyph &glyph = it.second;
+		BitmapGlyph g = {
+			it.first,
+			static_cast<Uint16>(glyph.w), static_cast<Uint16>(glyph.h),
+			static_cast<Sint16>(glyph.minx), static_cast<Sint16>(glyph.maxx),
+			static_cast<Sint16>(glyph.maxy), static_cast<Sint16>(glyph.advance),
+			0, 0
+		};
+		entries[it.first] = make_pair(g, glyph.fill);
+	}
+
+	BitmapHeader header;
+	memcpy(header.magic, BITMAP_FONT_MAGIC, 8);
+	header.size = size;
+	header.pathLength = path.length();
+	header.ttfModified = ttf.st_mtime;
+	header.ttfSize = ttf.st_size;
+	header.lineSpacing = lineSpacing;
+	header.ascent = ascent;
+	header.numGlyphs = entries.size();
+	header.numKerningPairs = kerningPairs.size();
+
+	size_t offset = sizeof(BitmapHeader) + align4(header.pathLength)
+			+ entries.size() * sizeof(BitmapGlyph)
+			+ kerningPairs.size() * sizeof(BitmapKerning);
+	vector<BitmapGlyph> glyphTable;
+	glyphTable.reserve(entries.size());
+	for (auto &entry : entries) {
+		BitmapGlyph g = entry.second.first;
+		g.offset = offset;
+		offset += (size_t) g.w * g.h;
+		glyphTable.push_back(g);
+	}
+	vector<BitmapKerning> kerning;
+	kerning.reserve(kerningPairs.size());
+	for (auto &pair : kerningPairs) {
+		kerning.push_back({ pair.first, pair.second });
+	}
+
+	const string dir = GMenu2X::getHome() + "/fonts";
+	if (mkdir(dir.c_str(), 0770) < 0 && errno != EEXIST) {
+		ERROR("Unable to create directory %s\n", dir.c_str());
+		return;
+	}
+
+	/* Write to a temporary file and rename it afterwards, so a bitmap font
+	 * that is mapped (possibly by this process) is never modified. */
+	const string bitmapPath = getBitmapPath();
+	const string tmpPath = bitmapPath + ".tmp";
+	FILE *f = fopen(tmpPath.c_str(), "wb");
+	if (!f) {
+		ERROR("Unable to write bitmap font %s\n", tmpPath.c_str());
+		return;
+	}
+	static const char padding[4] = { 0 };
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+			&& fwrite(path.data(), 1, path.length(), f) == path.length()
+			&& fwrite(padding, 1, align4(path.length()) - path.length(), f)
+					== align4(path.length()) - path.length()
+			&& fwrite(glyphTable.data(), sizeof(BitmapGlyph), glyphTable.size(), f)
+					== glyphTable.size()
+			&& fwrite(kerning.data(), sizeof(BitmapKerning), kerning.size(), f)
+					== kerning.size();
+	for (auto &entry : entries) {
+		const BitmapGlyph &g = entry.second.first;
+		const size_t n = (size_t) g.w * g.h;
+		ok = ok && (n == 0 || fwrite(entry.second.second, 1, n, f) == n);
+	}
+	if (fclose(f) != 0 || !ok || rename(tmpPath.c_str(), bitmapPath.c_str()) < 0) {
+		ERROR("Unable to write bitmap font %s\n", bitmapPath.c_str());
+		unlink(tmpPath.c_str());
+		return;
+	}
+
+	DEBUG("Saved bitmap font %s with %zu glyphs\n",
+			bitmapPath.c_str(), entries.size());
+	bitmapDirty = false;
+}
+
+const Font::BitmapGlyph *Font::findBitmapGlyph(Uint16 ch)
+{
+	const BitmapGlyph *end = bitmapGlyphs + numBitmapGlyphs;
+	const BitmapGlyph *g = lower_bound(bitmapGlyphs, end, ch,
+			[](BitmapGlyph const& g, Uint16 ch) { return g.ch < ch; });
+	return g != end && g->ch == ch ? g : nullptr;
+}
+
+void Font::setStyle(RGBAColor const& text, RGBAColor const& outline,
+			unsigned int outlineWidth)
+{
+	textColor = { text.r, text.g, text.b, text.a };
+	outlineColor = { outline.r, outline.g, outline.b, outline.a };
+	if (outlineWidth != this->outlineWidth) {
+		this->outlineWidth = outlineWidth;
+		clearOutlines();
+	}
+}
+
+void Font::setLineCacheBudget(size_t bytes)
+{
+	lineCacheBudget = bytes;
+	trimLineCache();
 }
 
 int Font::getTextWidth(const string &text)
 {
-	if (!font) {
+	if (!isLoaded()) {
 		return 1;
 	}
 
-	int w;
 	size_t pos = text.find('\n', 0);
 	if (pos == string::npos) {
-		TTF_SizeUTF8(font, text.c_str(), &w, nullptr);
-		return w;
+		auto it = lineCacheIndex.find(text);
+		if (it != lineCacheIndex.end()) {
+			return it->second->width;
+		}
+		return layoutLine(text, nullptr);
 	} else {
 		int maxWidth = 1;
 		size_t prev = 0;
 		do {
-			TTF_SizeUTF8(font, text.substr(prev, pos - prev).c_str(), &w, nullptr);
-			maxWidth = max(w, maxWidth);
+			maxWidth = max(maxWidth,
+					layoutLine(text.substr(prev, pos - prev), nullptr));
 			prev = pos + 1;
 			pos = text.find('\n', prev);
 		} while (pos != string::npos);
-		TTF_SizeUTF8(font, text.substr(prev).c_str(), &w, nullptr);
-		return max(w, maxWidth);
+		return max(maxWidth, layoutLine(text.substr(prev), nullptr));
 	}
 }
 
@@ -100,70 +433,33 @@ string Font::wordWrapSingleLine(const string &text, size_t start, size_t end, in
 	string result;
 	result.reserve(end - start);
 
-	while (start != end) {
-		/* Clean the end of the string, allowing lines that are indented at
-		 * the start to stay as such. */
-		string run = rtrim(text.substr(start, end - start));
-		int runWidth = getTextWidth(run);
-
-		if (runWidth > width) {
-			size_t fits = 0, doesntFit = run.length();
-			/* First guess: width / runWidth approximates the proportion of
-			 * the run that should fit. */
-			size_t guess = min(run.length(), (size_t) (doesntFit * ((float) width / runWidth)));
-			/* Adjust that to fully include any partial UTF-8 character. */
-			while (guess < run.length() && !isUTF8Starter(run[guess])) {
-				guess++;
-			}
-
-			if (getTextWidth(run.substr(0, guess)) <= width) {
-				fits = guess;
-				doesntFit = fits;
-				/* Prime doesntFit, which should be closer to 2 * fits than
-				 * to run.length() / 2 if the run is long. */
-				do {
-					fits = doesntFit; // determined to fit by a previous iteration
-					doesntFit = min(2 * fits, run.length());
-					while (doesntFit < run.length() && !isUTF8Starter(run[doesntFit])) {
-						doesntFit++;
-					}
-				} while (doesntFit < run.length() && getTextWidth(run.substr(0, doesntFit)) <= width);
-			} else {
-				doesntFit = guess;
-			}
+	/* Clean the end of the string, allowing lines that are indented at
+	 * the start to stay as such. */
+	const string line = rtrim(text.substr(start, end - start));
 
-			/* End this loop when N full characters fit but N + 1 don't. */
-			while (fits + 1 < doesntFit) {
-				size_t guess = fits + (doesntFit - fits) / 2;
-				if (!isUTF8Starter(run[guess])) {
-					size_t oldGuess = guess;
-					/* Adjust the guess to fully include a UTF-8 character. */
-					for (size_t offset = 1; offset < (doesntFit - fits) / 2 - 1; offset++) {
-						if (isUTF8Starter(run[guess - offset])) {
-							guess -= offset;
-							break;
-						} else if (isUTF8Starter(run[guess + offset])) {
-							guess += offset;
-							break;
-						}
-					}
-					/* If there's no such character, exit early. */
-					if (guess == oldGuess) {
-						break;
-					}
-				}
-				if (getTextWidth(run.substr(0, guess)) <= width) {
-					fits = guess;
-				} else {
-					doesntFit = guess;
-				}
+	/* Every run is measured only up to the first character that does not
+	 * fit, so wrapping a line takes time linear in its length. */
+	vector<int> widths;
+	size_t pos = 0;
+	while (pos < line.length()) {
+		getPrefixWidths(line, widths, pos, width);
+
+		if (widths.back() > width) {
+			/* Find the longest prefix that fits. Since the widths never
+			 * decrease, that is the entry before the first one that is too
+			 * wide, adjusted to fully include any partial UTF-8 character. */
+			size_t fits = upper_bound(widths.begin(), widths.end(), width)
+					- widths.begin();
+			fits = fits ? fits - 1 : 0;
+			while (fits > 0 && !isUTF8Starter(line[pos + fits])) {
+				fits--;
 			}
 
 			/* The run shall be split at the last space-separated word that
 			 * fully fits, or otherwise at the last character that fits. */
-			size_t lastSpace = run.find_last_of(" \t\r", fits);
-			if (lastSpace != string::npos) {
-				fits = lastSpace;
+			size_t lastSpace = line.find_last_of(" \t\r", pos + fits);
+			if (lastSpace != string::npos && lastSpace >= pos) {
+				fits = lastSpace - pos;
 			}
 
 			/* If 0 characters fit, we'll have to make 1 fit anyway, otherwise
@@ -171,22 +467,52 @@ string Font::wordWrapSingleLine(const string &text, size_t start, size_t end, in
 			 * is large. */
 			if (fits == 0) {
 				fits = 1;
-				while (fits < run.length() && !isUTF8Starter(run[fits])) {
+				while (pos + fits < line.length()
+						&& !isUTF8Starter(line[pos + fits])) {
 					fits++;
 				}
 			}
 
-			result.append(rtrim(run.substr(0, fits))).append("\n");
-			start = min(end, text.find_first_not_of(" \t\r", start + fits));
+			result.append(rtrim(line.substr(pos, fits))).append("\n");
+			pos = min(line.length(), line.find_first_not_of(" \t\r", pos + fits));
 		} else {
-			result.append(rtrim(run));
-			start = end;
+			result.append(line, pos, string::npos);
+			pos = line.length();
 		}
 	}
 
 	return result;
 }
 
+string Font::ellipsize(const string &text, int width)
+{
+	static const string ellipsis = "..";
+
+	vector<int> widths;
+	getPrefixWidths(text, widths);
+	if (widths.back() <= width) {
+		return text;
+	}
+
+	/* The width of a prefix followed by the ellipsis is close to the sum of
+	 * their widths, but kerning and overhanging glyphs may make it differ
+	 * by a pixel or two, so check the result and back off if needed. */
+	const int ellipsisWidth = getTextWidth(ellipsis);
+	size_t len = upper_bound(widths.begin(), widths.end(), width - ellipsisWidth)
+			- widths.begin();
+	while (len > 0) {
+		len--;
+		if (!isUTF8Starter(text[len])) {
+			continue;
+		}
+		string shortened = text.substr(0, len) + ellipsis;
+		if (getTextWidth(shortened) <= width) {
+			return shortened;
+		}
+	}
+	return ellipsis;
+}
+
 int Font::getTextHeight(const string &text)
 {
 	int nLines = 1;
@@ -201,7 +527,7 @@ int Font::getTextHeight(const string &text)
 int Font::write(Surface& surface, const string &text,
 			int x, int y, HAlign halign, VAlign valign)
 {
-	if (!font) {
+	if (!isLoaded()) {
 		return 0;
 	}
 
@@ -228,7 +554,6 @@ int Font::writeLine(Surface& surface, std::string const& text,
 				int x, int y, HAlign halign, VAlign valign)
 {
 	if (text.empty()) {
-		// SDL_ttf will return a nullptr when rendering the empty string.
 		return 0;
 	}
 
@@ -243,13 +568,8 @@ int Font::writeLine(Surface& surface, std::string const& text,
 		break;
 	}
 
-	SDL_Color color = { 0, 0, 0, 0 };
-	SDL_Surface *s = TTF_RenderUTF8_Blended(font, text.c_str(), color);
-	if (!s) {
-		ERROR("Font rendering failed for text \"%s\"\n", text.c_str());
-		return 0;
-	}
-	const int width = s->w;
+	const RenderedLine &line = getLine(text);
+	const int width = line.width;
 
 	switch (halign) {
 	case HAlignLeft:
@@ -262,37 +582,418 @@ int Font::writeLine(Surface& surface, std::string const& text,
 		break;
 	}
 
-	SDL_Rect rect = { (Sint16) x, (Sint16) (y - 1), 0, 0 };
-	SDL_BlitSurface(s, NULL, surface.raw, &rect);
+	blendLine(surface.raw, line, x, y);
 
-	/* Note: rect.x / rect.y are reset everytime because SDL_BlitSurface
-	 * will modify them if negative */
-	rect.x = x;
-	rect.y = y + 1;
-	SDL_BlitSurface(s, NULL, surface.raw, &rect);
+	return width;
+}
 
-	rect.x = x - 1;
-	rect.y = y;
-	SDL_BlitSurface(s, NULL, surface.raw, &rect);
+void Font::getPrefixWidths(const std::string& text, std::vector<int>& widths,
+			size_t from, int limit)
+{
+	widths.clear();
+	if (!isLoaded()) {
+		widths.resize(text.length() - from + 1, 0);
+		return;
+	}
+	layoutLine(text, nullptr, &widths, from, limit);
+}
 
-	rect.x = x + 1;
-	rect.y = y;
-	SDL_BlitSurface(s, NULL, surface.raw, &rect);
-	SDL_FreeSurface(s);
+int Font::layoutLine(std::string const& text, std::vector<PlacedGlyph> *placed,
+			std::vector<int> *prefixWidths, size_t from, int limit)
+{
+	if (placed) {
+		placed->clear();
+	}
+	if (prefixWidths) {
+		prefixWidths->clear();
+		prefixWidths->push_back(0);
+	}
+
+	/* This follows the size computation of TTF_SizeUTF8(), so the widths we
+	 * return are identical to what SDL_ttf would return. */
+	int pen = 0, minx = 0, maxx = 0;
+	Uint16 prev = 0;
+	size_t pos = from;
+	while (pos < text.length() && maxx - minx <= limit) {
+		const size_t charStart = pos;
+		Uint16 ch = decodeUTF8(text, pos);
+		const Glyph &glyph = getGlyph(ch);
+		if (prev) {
+			pen += getKerning(prev, ch);
+		}
+		prev = ch;
+
+		minx = min(minx, pen + glyph.minx);
+		maxx = max(maxx, pen + max(glyph.advance, glyph.maxx));
+		if (placed && glyph.fill) {
+			placed->push_back({ &glyph, pen + glyph.minx, ascent - glyph.maxy });
+		}
+		pen += glyph.advance;
+
+		if (prefixWidths) {
+			/* Every byte of the character gets the width including the
+			 * whole character, which keeps the table non-decreasing. */
+			prefixWidths->insert(prefixWidths->end(), pos - charStart, maxx - minx);
+		}
+	}
+
+	/* Glyphs that start left of the pen position, like a leading 'j', would
+	 * be cut off; shift the whole line right instead, like SDL_ttf does. */
+	if (placed && minx < 0) {
+		for (auto &p : *placed) {
+			p.x -= minx;
+		}
+	}
+
+	return maxx - minx;
+}
+
+const Font::Glyph &Font::getGlyph(Uint16 ch)
+{
+	auto it = glyphs.find(ch);
+	if (it != glyphs.end()) {
+		Glyph &glyph = it->second;
+		if (glyph.fill && outlineWidth && !glyph.outline) {
+			outlineGlyph(glyph);
+		}
+		return glyph;
+	}
+
+	Glyph &glyph = glyphs[ch];
+	glyph.fill = glyph.outline = nullptr;
+	glyph.w = glyph.h = 0;
+	if (const BitmapGlyph *g = findBitmapGlyph(ch)) {
+		glyph.minx = g->minx;
+		glyph.maxx = g->maxx;
+		glyph.maxy = g->maxy;
+		glyph.advance = g->advance;
+		if (g->w && g->h) {
+			glyph.fill = static_cast<const Uint8 *>(bitmapData) + g->offset;
+			glyph.w = g->w;
+			glyph.h = g->h;
+		}
+	} else {
+		rasterizeGlyph(ch, glyph);
+		bitmapDirty = true;
+	}
 
-	rect.x = x;
-	rect.y = y;
-	color.r = 0xff;
-	color.g = 0xff;
-	color.b = 0xff;
+	if (glyph.fill && outlineWidth) {
+		outlineGlyph(glyph);
+	}
+	return glyph;
+}
 
-	s = TTF_RenderUTF8_Blended(font, text.c_str(), color);
-	if (!s) {
-		ERROR("Font rendering failed for text \"%s\"\n", text.c_str());
-		return width;
+void Font::rasterizeGlyph(Uint16 ch, Glyph &glyph)
+{
+	int miny;
+	if (!openFont() || TTF_GlyphMetrics(font, ch, &glyph.minx, &glyph.maxx,
+				&miny, &glyph.maxy, &glyph.advance) < 0) {
+		ERROR("Unable to get metrics of glyph U+%04X\n", ch);
+		glyph.minx = glyph.maxx = glyph.maxy = glyph.advance = 0;
+		return;
+	}
+
+	SDL_Color white = { 0xff, 0xff, 0xff, 0 };
+	SDL_Surface *s = TTF_RenderGlyph_Blended(font, ch, white);
+	if (!s || s->w <= 0 || s->h <= 0) {
+		// Nothing to draw, for example a space.
+		SDL_FreeSurface(s);
+		return;
 	}
-	SDL_BlitSurface(s, NULL, surface.raw, &rect);
+
+	const int w = s->w, h = s->h;
+	Uint8 *fill = fillAtlas.allocate(w * h);
+
+	// The rendered glyph is white; its alpha channel is the coverage.
+	SDL_LockSurface(s);
+	const Uint32 Amask = s->format->Amask;
+	const Uint8 Ashift = s->format->Ashift;
+	for (int y = 0; y < h; y++) {
+		const Uint32 *src = reinterpret_cast<const Uint32 *>(
+				static_cast<const Uint8 *>(s->pixels) + y * s->pitch);
+		for (int x = 0; x < w; x++) {
+			fill[y * w + x] = (src[x] & Amask) >> Ashift;
+		}
+	}
+	SDL_UnlockSurface(s);
 	SDL_FreeSurface(s);
 
-	return width;
+	glyph.fill = fill;
+	glyph.w = w;
+	glyph.h = h;
+}
+
+void Font::outlineGlyph(Glyph &glyph)
+{
+	// The outline is the glyph drawn at every offset up to the outline
+	// width away (in Manhattan distance), composited on top of each
+	// other. This is the coverage that drawing the text several times
+	// with a small offset would produce, but computed once per glyph.
+	const int w = glyph.w, h = glyph.h, r = outlineWidth;
+	const int ow = w + 2 * r, oh = h + 2 * r;
+	const Uint8 *fill = glyph.fill;
+	Uint8 *outline = outlineAtlas.allocate(ow * oh);
+	for (int oy = 0; oy < oh; oy++) {
+		for (int ox = 0; ox < ow; ox++) {
+			unsigned int transparency = 255;
+			for (int dy = -r; dy <= r; dy++) {
+				const int sy = oy - r - dy;
+				if (sy < 0 || sy >= h) continue;
+				const int rx = r - abs(dy);
+				for (int dx = -rx; dx <= rx; dx++) {
+					const int sx = ox - r - dx;
+					if ((dx == 0 && dy == 0) || sx < 0 || sx >= w) continue;
+					transparency = (transparency * (255 - fill[sy * w + sx]) + 127) / 255;
+				}
+			}
+			outline[oy * ow + ox] = 255 - transparency;
+		}
+	}
+	glyph.outline = outline;
+}
+
+int Font::getKerning(Uint16 prev, Uint16 ch)
+{
+	const Uint32 key = (static_cast<Uint32>(prev) << 16) | ch;
+	auto it = kerningPairs.find(key);
+	if (it != kerningPairs.end()) {
+		return it->second;
+	}
+
+	/* If none of the pairs measured before were kerned, the font most likely
+	 * has no kerning at all: don't open it with FreeType just to confirm that
+	 * for a new pair. Once it is open for another reason, measure anyway. */
+	if (!font && (!bitmapKerning || openFailed)) {
+		return 0;
+	}
+	if (!openFont()) {
+		return 0;
+	}
+
+	/* SDL_ttf has no public API for kerning by character, so derive it from
+	 * the size of the pair with and without kerning. This has to be done only
+	 * once per pair, after which the result is looked up. */
+	const Uint16 pair[3] = { prev, ch, 0 };
+	int kernedWidth;
+	int delta = 0;
+	if (TTF_SizeUNICODE(font, pair, &kernedWidth, nullptr) == 0) {
+		const Glyph &a = getGlyph(prev), &b = getGlyph(ch);
+		const int minx = min(0, min(a.minx, a.advance + b.minx));
+		const int maxx = max(a.advance + max(b.advance, b.maxx),
+				max(a.advance, a.maxx));
+		/* Only trust the difference if the second glyph determines the
+		 * right edge, otherwise the kerning is not visible in the size. */
+		if (a.advance + max(b.advance, b.maxx) >= max(a.advance, a.maxx)) {
+			delta = kernedWidth - (maxx - minx);
+		}
+	}
+
+	kerningPairs[key] = delta;
+	bitmapDirty = true;
+	return delta;
+}
+
+Uint8 *Font::Atlas::allocate(size_t size)
+{
+	if (size > free) {
+		const size_t blockSize = max(size, (size_t) ATLAS_BLOCK_SIZE);
+		blocks.emplace_back(new Uint8[blockSize]);
+		free = blockSize;
+	}
+	// Allocate from the end of the most recent block.
+	free -= size;
+	return blocks.back().get() + free;
+}
+
+void Font::Atlas::clear()
+{
+	blocks.clear();
+	free = 0;
+}
+
+void Font::clearOutlines()
+{
+	for (auto &it : glyphs) {
+		it.second.outline = nullptr;
+	}
+	outlineAtlas.clear();
+
+	lineCache.clear();
+	lineCacheIndex.clear();
+	lineCacheSize = 0;
+}
+
+const Font::RenderedLine &Font::getLine(std::string const& text)
+{
+	auto it = lineCacheIndex.find(text);
+	if (it != lineCacheIndex.end()) {
+		lineCacheHits++;
+		lineCache.splice(lineCache.begin(), lineCache, it->second);
+		return *it->second;
+	}
+
+	lineCacheMisses++;
+	lineCache.emplace_front();
+	RenderedLine &line = lineCache.front();
+	line.text = text;
+	line.width = layoutLine(text, &placedGlyphs);
+	composeLine(line);
+	lineCacheIndex[text] = lineCache.begin();
+	lineCacheSize += text.capacity() + line.fill.capacity()
+			+ line.outline.capacity() + sizeof(RenderedLine);
+
+	trimLineCache();
+	return line;
+}
+
+void Font::trimLineCache()
+{
+	while (lineCacheSize > lineCacheBudget && lineCache.size() > 1) {
+		RenderedLine &line = lineCache.back();
+		lineCacheSize -= line.text.capacity() + line.fill.capacity()
+				+ line.outline.capacity() + sizeof(RenderedLine);
+		lineCacheIndex.erase(line.text);
+		lineCache.pop_back();
+	}
+}
+
+/* Composites coverage b on top of coverage a. */
+static inline Uint8 coverageOver(Uint8 a, Uint8 b)
+{
+	return a + b - (a * b + 127) / 255;
+}
+
+void Font::composeLine(RenderedLine &line)
+{
+	const int r = outlineWidth;
+
+	int minX = 0, minY = 0, maxX = 0, maxY = 0;
+	for (auto &placed : placedGlyphs) {
+		minX = min(minX, placed.x);
+		minY = min(minY, placed.y);
+		maxX = max(maxX, placed.x + placed.glyph->w);
+		maxY = max(maxY, placed.y + placed.glyph->h);
+	}
+	const int w = maxX - minX + 2 * r, h = maxY - minY + 2 * r;
+	const int originX = minX - r, originY = minY - r;
+	line.rect = {
+		static_cast<Sint16>(originX), static_cast<Sint16>(originY),
+		static_cast<Uint16>(w), static_cast<Uint16>(h)
+	};
+
+	std::vector<Uint8> &lineFill = line.fill, &lineOutline = line.outline;
+	lineFill.assign(w * h, 0);
+	lineOutline.assign(r ? w * h : 0, 0);
+
+	for (auto &placed : placedGlyphs) {
+		const Glyph &glyph = *placed.glyph;
+		const int gx = placed.x - originX, gy = placed.y - originY;
+		for (int y = 0; y < glyph.h; y++) {
+			Uint8 *dst = &lineFill[(gy + y) * w + gx];
+			const Uint8 *src = &glyph.fill[y * glyph.w];
+			for (int x = 0; x < glyph.w; x++) {
+				dst[x] = coverageOver(dst[x], src[x]);
+			}
+		}
+		if (r) {
+			const int ow = glyph.w + 2 * r, oh = glyph.h + 2 * r;
+			for (int y = 0; y < oh; y++) {
+				Uint8 *dst = &lineOutline[(gy - r + y) * w + gx - r];
+				const Uint8 *src = &glyph.outline[y * ow];
+				for (int x = 0; x < ow; x++) {
+					dst[x] = coverageOver(dst[x], src[x]);
+				}
+			}
+		}
+	}
+}
+
+/* Divides by 255, exact for all products of two 8-bit values. */
+static inline unsigned int div255(unsigned int x)
+{
+	return (x + 1 + (x >> 8)) >> 8;
+}
+
+template <typename Pixel>
+static void blendLinePixels(SDL_Surface *dst, SDL_Rect const& rect,
+		int offsetX, int offsetY, int stride,
+		const Uint8 *fill, const Uint8 *outline,
+		const Uint8 (&text)[4], const Uint8 (&edge)[4])
+{
+	// The text is opaque, so an alpha channel is blended towards 255; this
+	// gives the correct result on surfaces with premultiplied alpha.
+	const SDL_PixelFormat *fmt = dst->format;
+	const Uint32 masks[4] = { fmt->Rmask, fmt->Gmask, fmt->Bmask, fmt->Amask };
+	const Uint8 shifts[4] = { fmt->Rshift, fmt->Gshift, fmt->Bshift, fmt->Ashift };
+	const Uint8 losses[4] = { fmt->Rloss, fmt->Gloss, fmt->Bloss, fmt->Aloss };
+	const int numComponents = fmt->Amask ? 4 : 3;
+	const Uint8 textValues[4] = { text[0], text[1], text[2], 255 };
+	const Uint8 edgeValues[4] = { edge[0], edge[1], edge[2], 255 };
+
+	for (int y = 0; y < rect.h; y++) {
+		Pixel *row = reinterpret_cast<Pixel *>(
+				static_cast<Uint8 *>(dst->pixels)
+				+ (rect.y + y) * dst->pitch) + rect.x;
+		const int i0 = (offsetY + y) * stride + offsetX;
+		for (int x = 0; x < rect.w; x++) {
+			const unsigned int o = outline ? div255(outline[i0 + x] * edge[3]) : 0;
+			const unsigned int f = div255(fill[i0 + x] * text[3]);
+			if (!o && !f) continue;
+
+			Pixel p = row[x];
+			Pixel q = p & ~(masks[0] | masks[1] | masks[2] | masks[3]);
+			for (int c = 0; c < numComponents; c++) {
+				unsigned int v = ((p & masks[c]) >> shifts[c]) << losses[c];
+				v = div255(v * (255 - o) + edgeValues[c] * o);
+				v = div255(v * (255 - f) + textValues[c] * f);
+				q |= ((v >> losses[c]) << shifts[c]) & masks[c];
+			}
+			row[x] = q;
+		}
+	}
+}
+
+void Font::blendLine(SDL_Surface *dst, RenderedLine const& line, int x, int y)
+{
+	const int left = line.rect.x + x, top = line.rect.y + y;
+
+	// Clip against the destination's clipping rectangle.
+	SDL_Rect clip = dst->clip_rect;
+	const int x0 = max<int>(left, clip.x);
+	const int y0 = max<int>(top, clip.y);
+	const int x1 = min<int>(left + line.rect.w, clip.x + clip.w);
+	const int y1 = min<int>(top + line.rect.h, clip.y + clip.h);
+	if (x0 >= x1 || y0 >= y1) {
+		return;
+	}
+	SDL_Rect area = {
+		static_cast<Sint16>(x0), static_cast<Sint16>(y0),
+		static_cast<Uint16>(x1 - x0), static_cast<Uint16>(y1 - y0)
+	};
+
+	if (SDL_MUSTLOCK(dst) && SDL_LockSurface(dst) < 0) {
+		return;
+	}
+
+	const Uint8 text[4] = { textColor.r, textColor.g, textColor.b, textColor.a };
+	const Uint8 edge[4] = { outlineColor.r, outlineColor.g, outlineColor.b, outlineColor.a };
+	const Uint8 *outline = line.outline.empty() ? nullptr : line.outline.data();
+	switch (dst->format->BytesPerPixel) {
+	case 2:
+		blendLinePixels<Uint16>(dst, area, x0 - left, y0 - top, line.rect.w,
+				line.fill.data(), outline, text, edge);
+		break;
+	case 4:
+		blendLinePixels<Uint32>(dst, area, x0 - left, y0 - top, line.rect.w,
+				line.fill.data(), outline, text, edge);
+		break;
+	default:
+		ERROR("Text rendering to %d bpp surfaces is not supported\n",
+				dst->format->BitsPerPixel);
+		break;
+	}
+
+	if (SDL_MUSTLOCK(dst)) {
+		SDL_UnlockSurface(dst);
+	}
 }
@@ -5,15 +5,24 @@
 #define FONT_H
 
 #include <SDL_ttf.h>
+#include <climits>
+#include <list>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 class Surface;
+struct RGBAColor;
 
 /**
  * Wrapper around a TrueType or other FreeType-supported font.
  * The wrapper is valid even if the font couldn't be loaded, but in that case
  * nothing will be drawn.
+ *
+ * The glyphs that were used are kept in a pre-rasterized bitmap font in the
+ * user's GMenu2X directory, which is mapped into memory on the next run, so
+ * FreeType is only used for glyphs that are missing from it.
  */
 class Font {
 public:
@@ -30,14 +39,51 @@ public:
 
 	std::string wordWrap(const std::string &text, int width);
 
+	/**
+	 * Returns the given single line of text, shortened and followed by ".."
+	 * if it is wider than the given width.
+	 */
+	std::string ellipsize(const std::string &text, int width);
+
 	int getTextWidth(const std::string& text);
 	int getTextHeight(const std::string& text);
 
+	/**
+	 * Measures all prefixes of a single line of text in one pass.
+	 * On return, widths[i] is the width in pixels of the i bytes of the text
+	 * that follow offset "from", where a partially included UTF-8 character
+	 * counts as a whole one; widths never decreases.
+	 * Measuring stops after the first character that makes the width exceed
+	 * "limit"; if none does, widths has text.length() - from + 1 entries.
+	 */
+	void getPrefixWidths(const std::string& text, std::vector<int>& widths,
+				size_t from = 0, int limit = INT_MAX);
+
 	int getLineSpacing()
 	{
 		return lineSpacing;
 	}
 
+	/**
+	 * Sets the colors of the text and of its outline, and the width of the
+	 * outline in pixels. A width of 0 disables the outline.
+	 */
+	void setStyle(RGBAColor const& text, RGBAColor const& outline,
+				unsigned int outlineWidth);
+
+	/**
+	 * Sets the maximum amount of memory, in bytes, used to keep rendered
+	 * lines of text for reuse. Lines are evicted least recently used first.
+	 */
+	void setLineCacheBudget(size_t bytes);
+
+	/**
+	 * Returns how many lines were drawn from the cache since the font was
+	 * created, and how many had to be rendered.
+	 */
+	unsigned int getLineCacheHits() { return lineCacheHits; }
+	unsigned int getLineCacheMisses() { return lineCacheMisses; }
+
 	/**
 	 * Draws a text on a surface in this font.
 	 * @return The width of the text in pixels.
@@ -47,6 +93,61 @@ public:
 				HAlign halign = HAlignLeft, VAlign valign = VAlignTop);
 
 private:
+	struct Color {
+		Uint8 r, g, b, a;
+	};
+
+	/**
+	 * Bump allocator for glyph coverage maps.
+	 */
+	class Atlas {
+	public:
+		Atlas() : free(0) {}
+		Uint8 *allocate(size_t size);
+		void clear();
+	private:
+		std::vector<std::unique_ptr<Uint8[]>> blocks;
+		size_t free;
+	};
+
+	/**
+	 * Layout of the on-disk bitmap font; defined in font.cpp.
+	 */
+	struct BitmapHeader;
+	struct BitmapGlyph;
+	struct BitmapKerning;
+
+	/**
+	 * Metrics of a single glyph and its coverage maps in the glyph atlas.
+	 * The outline map is larger than the glyph by the outline width on each
+	 * side; it does not cover the glyph itself, only its surroundings.
+	 */
+	struct Glyph {
+		const Uint8 *fill, *outline;
+		int w, h;
+		int minx, maxx, maxy, advance;
+	};
+
+	/**
+	 * Position at which a glyph should be drawn, relative to the top left
+	 * corner of the line of text.
+	 */
+	struct PlacedGlyph {
+		const Glyph *glyph;
+		int x, y;
+	};
+
+	/**
+	 * A line of text rendered to coverage maps. Since the colors are only
+	 * applied when blending, changing them does not invalidate the line.
+	 */
+	struct RenderedLine {
+		std::string text;
+		SDL_Rect rect;
+		int width;
+		std::vector<Uint8> fill, outline;
+	};
+
 	Font(TTF_Font *font);
 
 	std::string wordWrapSingleLine(const std::string &text,
@@ -59,8 +160,130 @@ private:
 	int writeLine(Surface& surface, std::string const& text,
 				int x, int y, HAlign halign, VAlign valign);
 
+	/**
+	 * Opens the font with FreeType, if that wasn't done yet.
+	 * @return True iff the font is open.
+	 */
+	bool openFont();
+
+	/**
+	 * Returns true iff glyphs can be drawn, either from the bitmap font or
+	 * through FreeType.
+	 */
+	bool isLoaded() { return font || bitmapData; }
+
+	/**
+	 * Returns the path of the bitmap font for this font and size.
+	 */
+	std::string getBitmapPath();
+
+	/**
+	 * Maps the bitmap font into memory, if there is an up-to-date one.
+	 * @return True iff the bitmap font was loaded.
+	 */
+	bool loadBitmapFont();
+
+	/**
+	 * Writes all glyphs and kerning pairs known so far to the bitmap font.
+	 */
+	void saveBitmapFont();
+
+	/**
+	 * Looks up a glyph in the bitmap font.
+	 * @return The glyph, or nullptr if the bitmap font doesn't contain it.
+	 */
+	const BitmapGlyph *findBitmapGlyph(Uint16 ch);
+
+	/**
+	 * Returns the glyph for the given character, taking it from the bitmap
+	 * font or rasterizing it on first use.
+	 */
+	const Glyph &getGlyph(Uint16 ch);
+
+	/**
+	 * Rasterizes a glyph with FreeType into the atlas.
+	 */
+	void rasterizeGlyph(Uint16 ch, Glyph &glyph);
+
+	/**
+	 * Computes the outline coverage map of a glyph.
+	 */
+	void outlineGlyph(Glyph &glyph);
+
+	/**
+	 * Returns the kerning adjustment between the two given characters.
+	 */
+	int getKerning(Uint16 prev, Uint16 ch);
+
+	/**
+	 * Drops all glyph outlines and rendered lines, for instance because the
+	 * outline width has changed.
+	 */
+	void clearOutlines();
+
+	/**
+	 * Computes the glyph positions for a single line of text.
+	 * @return The width of the text in pixels, computed the same way
+	 * SDL_ttf does.
+	 */
+	int layoutLine(std::string const& text, std::vector<PlacedGlyph> *placed,
+				std::vector<int> *prefixWidths = nullptr,
+				size_t from = 0, int limit = INT_MAX);
+
+	/**
+	 * Returns the given single line of text rendered, from the cache if
+	 * possible.
+	 */
+	const RenderedLine &getLine(std::string const& text);
+
+	/**
+	 * Drops least recently used lines until the cache fits in its budget.
+	 * The most recently used line is always kept.
+	 */
+	void trimLineCache();
+
+	/**
+	 * Combines the coverage of the placed glyphs into the line buffers.
+	 * On return, line.rect holds the position and size of the line buffers
+	 * relative to the line origin.
+	 */
+	void composeLine(RenderedLine &line);
+
+	/**
+	 * Blends a rendered line into the given surface at the given position,
+	 * outline first and text on top, in a single pass over the destination
+	 * pixels.
+	 */
+	void blendLine(SDL_Surface *dst, RenderedLine const& line, int x, int y);
+
+	std::string path;
+	unsigned int size;
 	TTF_Font *font;
+	bool openFailed;
 	int lineSpacing;
+	int ascent;
+
+	void *bitmapData;
+	size_t bitmapSize;
+	const BitmapGlyph *bitmapGlyphs;
+	unsigned int numBitmapGlyphs;
+	bool bitmapDirty;
+	/** False if a bitmap font is loaded and all its kerning pairs are 0. */
+	bool bitmapKerning;
+
+	Color textColor, outlineColor;
+	unsigned int outlineWidth;
+
+	std::unordered_map<Uint16, Glyph> glyphs;
+	std::unordered_map<Uint32, int> kerningPairs;
+	Atlas fillAtlas, outlineAtlas;
+
+	std::vector<PlacedGlyph> placedGlyphs;
+
+	std::list<RenderedLine> lineCache; // most recently used first
+	std::unordered_map<std::string, std::list<RenderedLine>::iterator> lineCacheIndex;
+	size_t lineCacheSize, lineCacheBudget;
+	unsigned int lineCacheHits, lineCacheMisses;
 };
 
 #endif /* FONT_H */
@@ -107,6 +107,8 @@ static const char *colorNames[NUM_COLORS] = {
 	"messageBoxBg",
 	"messageBoxBorder",
 	"messageBoxSelection",
+	"text",
+	"textOutline",
 };
 
 static enum color stringToColor(const string &name)
@@ -216,6 +218,7 @@ void GMenu2X::initCPULimits() {
 
 GMenu2X::GMenu2X()
 	: input(powerSaver)
+	, linkIndex(getHome() + "/cache/links.idx")
 {
 	usbnet = samba = inet = web = false;
 	useSelectionPng = false;
@@ -225,6 +228,7 @@ GMenu2X::GMenu2X()
 #endif
 	//load config data
 	readConfig();
+	sc.setBudget(static_cast<size_t>(confInt["imageCacheSize"]) << 20);
 
 	halfX = resX/2;
 	halfY = resY/2;
@@ -293,6 +297,7 @@ GMenu2X::GMenu2X()
 
 GMenu2X::~GMenu2X() {
 	fflush(NULL);
+	sc.dump();
 	sc.clear();
 
 #ifdef ENABLE_INOTIFY
@@ -304,8 +309,21 @@ void GMenu2X::initBG() {
 	bg.reset();
 	bgmain.reset();
 
-	// Load wallpaper.
-	bg = OffscreenSurface::loadImage(confStr["wallpaper"]);
+	// Load the wallpaper here while the icons are decoded on worker threads.
+	vector<SurfaceCollection::AssetId> icons = {
+		sc.internSkinRes("imgs/sd.png"),
+#ifdef ENABLE_CPUFREQ
+		sc.internSkinRes("imgs/cpu.png"),
+#endif
+	};
+	if (usbnet) {
+		if (web) icons.push_back(sc.internSkinRes("imgs/webserver.png"));
+		if (samba) icons.push_back(sc.internSkinRes("imgs/samba.png"));
+		if (inet) icons.push_back(sc.internSkinRes("imgs/inet.png"));
+	}
+	sc.preload(icons, [this] {
+		bg = sc.loadDisplayFormat(confStr["wallpaper"]);
+	});
 	if (!bg) {
 		bg = OffscreenSurface::emptySurface(resX, resY);
 	}
@@ -316,8 +334,7 @@ void GMenu2X::initBG() {
 	bgmain.reset(new OffscreenSurface(*bg));
 
 	{
-		auto sd = OffscreenSurface::loadImage(
-				sc.getSkinFilePath("imgs/sd.png"));
+		auto sd = sc.skinRes("imgs/sd.png");
 		if (sd) sd->blit(*bgmain, 3, bottomBarIconY);
 	}
 
@@ -326,8 +343,7 @@ void GMenu2X::initBG() {
 
 #ifdef ENABLE_CPUFREQ
 	{
-		auto cpu = OffscreenSurface::loadImage(
-				sc.getSkinFilePath("imgs/cpu.png"));
+		auto cpu = sc.skinRes("imgs/cpu.png");
 		if (cpu) cpu->blit(*bgmain, cpuX, bottomBarIconY);
 	}
 	cpuX += 19;
@@ -339,20 +355,17 @@ void GMenu2X::initBG() {
 	int serviceX = resX-38;
 	if (usbnet) {
 		if (web) {
-			auto webserver = OffscreenSurface::loadImage(
-					sc.getSkinFilePath("imgs/webserver.png"));
+			auto webserver = sc.skinRes("imgs/webserver.png");
 			if (webserver) webserver->blit(*bgmain, serviceX, bottomBarIconY);
 			serviceX -= 19;
 		}
 		if (samba) {
-			auto sambaS = OffscreenSurface::loadImage(
-					sc.getSkinFilePath("imgs/samba.png"));
+			auto sambaS = sc.skinRes("imgs/samba.png");
 			if (sambaS) sambaS->blit(*bgmain, serviceX, bottomBarIconY);
 			serviceX -= 19;
 		}
 		if (inet) {
-			auto inetS = OffscreenSurface::loadImage(
-					sc.getSkinFilePath("imgs/inet.png"));
+			auto inetS = sc.skinRes("imgs/inet.png");
 			if (inetS) inetS->blit(*bgmain, serviceX, bottomBarIconY);
 			serviceX -= 19;
 		}
@@ -373,6 +386,9 @@ void GMenu2X::initFont() {
 	} else {
 		font = Font::defaultFont();
 	}
+	font->setStyle(skinConfColors[COLOR_TEXT],
+			skinConfColors[COLOR_TEXT_OUTLINE],
+			skinConfInt["textOutlineWidth"]);
 }
 
 void GMenu2X::initMenu() {
@@ -492,6 +508,7 @@ void GMenu2X::readConfig(string conffile) {
 	evalIntConf( confInt, "backlightTimeout", 15, 0,120 );
 	evalIntConf( confInt, "buttonRepeatRate", 10, 0, 20 );
 	evalIntConf( confInt, "videoBpp", 32, 16, 32 );
+	evalIntConf( confInt, "imageCacheSize", 8, 1, 256 ); // MiB
 
 	if (confStr["tvoutEncoding"] != "PAL") confStr["tvoutEncoding"] = "NTSC";
 	resX = constrain( confInt["resolutionX"], 320,1920 );
@@ -598,6 +615,9 @@ void GMenu2X::mainLoop() {
 	if (!fileExists(CARD_ROOT))
 		CARD_ROOT = "";
 
+	// Images of removed links and skins would otherwise stay cached forever.
+	sc.pruneImageCache();
+
 	// Recover last session
 	readTmp();
 	if (lastSelectorElement > -1 && menu->selLinkApp() &&
@@ -621,11 +641,13 @@ void GMenu2X::mainLoop() {
 			animating |= layer->runAnimations();
 		}
 
-		// Paint layers.
-		for (auto layer : layers) {
-			layer->paint(*s);
+		// Paint layers, limited to the area that changed since the last frame;
+		// if nothing changed, the screen is left alone.
+		const SDL_Rect area = s->getRepaintArea(collectDamage());
+		if (area.w != 0 && area.h != 0) {
+			paintLayers(layers.size(), *s, area);
+			s->flip(area);
 		}
-		s->flip();
 
 		// Exit main loop once we have something to launch.
 		if (toLaunch) {
@@ -659,6 +681,84 @@ void GMenu2X::mainLoop() {
 	}
 }
 
+SDL_Rect GMenu2X::collectDamage() {
+	const SDL_Rect screen = {
+		0, 0, static_cast<Uint16>(resX), static_cast<Uint16>(resY)
+	};
+	SDL_Rect damage = { 0, 0, 0, 0 };
+
+	// Composites above a change in the stack are meaningless; whatever a
+	// removed layer covered is uncovered now.
+	size_t same = 0;
+	while (same < composites.size() && same < layers.size()
+			&& composites[same].layer == layers[same].get()) {
+		same++;
+	}
+	if (same != composites.size()) {
+		composites.resize(same);
+		damage = screen;
+	}
+	for (size_t i = same; i < layers.size(); i++) {
+		composites.push_back({ layers[i].get(), nullptr, screen });
+	}
+
+	// After something else drew the screen, don't trust any composite.
+	if (s->getFullFlipCount() != lastFullFlipCount) {
+		lastFullFlipCount = s->getFullFlipCount();
+		for (auto& composite : composites) {
+			composite.stale = screen;
+		}
+	}
+
+	// Damage to a layer affects its own composite and those above it.
+	for (size_t i = 0; i < layers.size(); i++) {
+		const SDL_Rect layerDamage = layers[i]->takeDamage();
+		if (layerDamage.w == 0 || layerDamage.h == 0) {
+			continue;
+		}
+		damage = rectUnion(damage, layerDamage);
+		for (size_t j = i; j < composites.size(); j++) {
+			composites[j].stale = rectUnion(composites[j].stale, layerDamage);
+		}
+	}
+
+	return damage;
+}
+
+void GMenu2X::paintLayers(size_t numLayers, Surface& s, SDL_Rect const& area) {
+	// Start from the composite of the topmost retained layer, if any.
+	size_t first = numLayers;
+	while (first > 0 && !layers[first - 1]->isRetained()) {
+		first--;
+	}
+	s.setClipRect(area);
+	if (first > 0) {
+		getComposite(first - 1).blit(s, 0, 0);
+	}
+	for (size_t i = first; i < numLayers; i++) {
+		layers[i]->paint(s);
+	}
+	s.clearClipRect();
+}
+
+Surface& GMenu2X::getComposite(size_t i) {
+	Composite& composite = composites[i];
+	if (!composite.surface) {
+		composite.surface.reset(new OffscreenSurface(*s));
+		composite.stale = { 0, 0, static_cast<Uint16>(resX),
+				static_cast<Uint16>(resY) };
+	}
+	if (composite.stale.w != 0 && composite.stale.h != 0) {
+		Surface& surface = *composite.surface;
+		paintLayers(i, surface, composite.stale);
+		surface.setClipRect(composite.stale);
+		layers[i]->paint(surface);
+		surface.clearClipRect();
+		composite.stale = { 0, 0, 0, 0 };
+	}
+	return *composite.surface;
+}
+
 void GMenu2X::explorer() {
 	FileDialog fd(this, ts, tr["Select an application"], "sh,bin,py,elf,");
 	if (fd.exec()) {
@@ -794,6 +894,18 @@ void GMenu2X::skinMenu() {
 			this, ts, tr["Message Box Selection"],
 			tr["Color of the selection of the message box"],
 			&skinConfColors[COLOR_MESSAGE_BOX_SELECTION])));
+	sd.addSetting(unique_ptr<MenuSetting>(new MenuSettingRGBA(
+			this, ts, tr["Text"],
+			tr["Color of the text"],
+			&skinConfColors[COLOR_TEXT])));
+	sd.addSetting(unique_ptr<MenuSetting>(new MenuSettingRGBA(
+			this, ts, tr["Text Outline"],
+			tr["Color of the outline around the text"],
+			&skinConfColors[COLOR_TEXT_OUTLINE])));
+	sd.addSetting(unique_ptr<MenuSetting>(new MenuSettingInt(
+			this, ts, tr["Text Outline Width"],
+			tr["Width of the outline around the text, 0 to disable"],
+			&skinConfInt["textOutlineWidth"], 0, 3)));
 
 	if (sd.exec()) {
 		if (curSkin != confStr["skin"]) {
@@ -801,7 +913,11 @@ void GMenu2X::skinMenu() {
 			writeConfig();
 		}
 		writeSkinConfig();
+		font->setStyle(skinConfColors[COLOR_TEXT],
+				skinConfColors[COLOR_TEXT_OUTLINE],
+				skinConfInt["textOutlineWidth"]);
 		initBG();
+		menu->skinUpdated();
 	}
 }
 
@@ -825,11 +941,13 @@ void GMenu2X::setSkin(const string &skin, bool setWallpaper) {
 	skinConfColors[COLOR_MESSAGE_BOX_BG] = RGBAColor(255, 255, 255);
 	skinConfColors[COLOR_MESSAGE_BOX_BORDER] = RGBAColor(80, 80, 80);
 	skinConfColors[COLOR_MESSAGE_BOX_SELECTION] = RGBAColor(160, 160, 160);
+	skinConfColors[COLOR_TEXT] = RGBAColor(255, 255, 255);
+	skinConfColors[COLOR_TEXT_OUTLINE] = RGBAColor(0, 0, 0);
 
 	/* Load skin settings from user directory if present,
 	 * or from the system directory. */
-	if (!readSkinConfig(getHome() + "/skins/" + skin + "/skin.conf")) {
-		readSkinConfig(GMENU2X_SYSTEM_DIR "/skins/" + skin + "/skin.conf");
+	if (!readSkinConfig(getHome() + "/skins/" + skin)) {
+		readSkinConfig(GMENU2X_SYSTEM_DIR "/skins/" + skin);
 	}
 
 	if (setWallpaper && !skinConfStr["wallpaper"].empty()) {
@@ -844,6 +962,7 @@ void GMenu2X::setSkin(const string &skin, bool setWallpaper) {
 	evalIntConf(skinConfInt, "bottomBarHeight", 20, 20, 120);
 	evalIntConf(skinConfInt, "linkHeight", 50, 32, 120);
 	evalIntConf(skinConfInt, "linkWidth", 80, 32, 120);
+	evalIntConf(skinConfInt, "textOutlineWidth", 1, 0, 3);
 
 	if (menu != NULL) menu->skinUpdated();
 
@@ -854,8 +973,24 @@ void GMenu2X::setSkin(const string &skin, bool setWallpaper) {
 	initFont();
 }
 
-bool GMenu2X::readSkinConfig(const string& conffile)
+bool GMenu2X::readSkinConfig(const string& skinDir)
 {
+	// A compiled skin holds the settings already parsed.
+	SkinBundle const* bundle = sc.getSkinBundle(skinDir);
+	if (bundle && bundle->readConfig(
+			[this](string const& name, string const& value) {
+				skinConfStr[name] = value;
+			},
+			[this](string const& name, int value) {
+				skinConfInt[name] = value;
+			},
+			[this](string const& name, RGBAColor value) {
+				skinConfColors[stringToColor(name)] = value;
+			})) {
+		return true;
+	}
+
+	const string conffile = skinDir + "/skin.conf";
 	ifstream skinconf(conffile.c_str(), ios_base::in);
 	if (skinconf.is_open()) {
 		string line;
@@ -946,7 +1081,7 @@ void GMenu2X::editLink() {
 		sd.addSetting(unique_ptr<MenuSetting>(new MenuSettingImage(
 				this, ts, tr["Icon"],
 				tr.translate("Select an icon for this link", linkTitle.c_str(), NULL),
-				&linkIcon, "png")));
+				&linkIcon, "png,qoi")));
 		sd.addSetting(unique_ptr<MenuSetting>(new MenuSettingFile(
 				this, ts, tr["Manual"],
 				tr["Select a manual or README file"],
@@ -1060,6 +1195,7 @@ void GMenu2X::renameSection() {
 
 					if (!fileExists(newicon)) {
 						rename(oldicon.c_str(), newicon.c_str());
+						sc.invalidateSkinIndex();
 						sc.move("skin:"+oldpng, "skin:"+newpng);
 					}
 				}
@@ -1151,7 +1287,7 @@ int GMenu2X::drawButtonRight(Surface& s, const string &btn, const string &text,
 	return x - w;
 }
 
-void GMenu2X::drawScrollBar(uint pageSize, uint totalSize, uint pagePos) {
+void GMenu2X::drawScrollBar(Surface& s, uint pageSize, uint totalSize, uint pagePos) {
 	if (totalSize <= pageSize) {
 		// Everything fits on one screen, no scroll bar needed.
 		return;
@@ -1162,19 +1298,19 @@ void GMenu2X::drawScrollBar(uint pageSize, uint totalSize, uint pagePos) {
 	top += 1;
 	height -= 2;
 
-	s->rectangle(resX - 8, top, 7, height, skinConfColors[COLOR_SELECTION_BG]);
+	s.rectangle(resX - 8, top, 7, height, skinConfColors[COLOR_SELECTION_BG]);
 	top += 2;
 	height -= 4;
 
 	const uint barSize = max(height * pageSize / totalSize, 4u);
 	const uint barPos = (height - barSize) * pagePos / (totalSize - pageSize);
 
-	s->box(resX - 6, top + barPos, 3, barSize,
+	s.box(resX - 6, top + barPos, 3, barSize,
 			skinConfColors[COLOR_SELECTION_BG]);
 }
 
 void GMenu2X::drawTopBar(Surface& s) {
-	Surface *bar = sc.skinRes("imgs/topbar.png", false);
+	auto bar = sc.skinRes("imgs/topbar.png", false);
 	if (bar) {
 		bar->blit(s, 0, 0);
 	} else {
@@ -1184,7 +1320,7 @@ void GMenu2X::drawTopBar(Surface& s) {
 }
 
 void GMenu2X::drawBottomBar(Surface& s) {
-	Surface *bar = sc.skinRes("imgs/bottombar.png", false);
+	auto bar = sc.skinRes("imgs/bottombar.png", false);
 	if (bar) {
 		bar->blit(s, 0, resY-bar->height());
 	} else {
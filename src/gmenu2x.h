@@ -22,6 +22,7 @@
 #define GMENU2X_H
 
 #include "contextmenu.h"
+#include "linkindex.h"
 #include "surfacecollection.h"
 #include "translator.h"
 #include "touchscreen.h"
@@ -64,6 +65,8 @@ enum color {
 	COLOR_MESSAGE_BOX_BG,
 	COLOR_MESSAGE_BOX_BORDER,
 	COLOR_MESSAGE_BOX_SELECTION,
+	COLOR_TEXT,
+	COLOR_TEXT_OUTLINE,
 
 	NUM_COLORS,
 };
@@ -80,6 +83,38 @@ private:
 
 	std::vector<std::shared_ptr<Layer>> layers;
 
+	/**
+	 * Composite of a layer and the layers beneath it, for each layer in the
+	 * stack as it was last painted. The surface is only allocated when the
+	 * layer is retained.
+	 */
+	struct Composite {
+		Layer *layer;
+		std::unique_ptr<OffscreenSurface> surface;
+		SDL_Rect stale; //!< Area of the surface that is out of date.
+	};
+	std::vector<Composite> composites;
+	unsigned int lastFullFlipCount = 0;
+
+	/**
+	 * Updates the composites to the current layer stack and adds the damage
+	 * reported by the layers to them.
+	 * Returns the area of the screen that changed.
+	 */
+	SDL_Rect collectDamage();
+
+	/**
+	 * Paints the bottom "numLayers" layers on the given surface, limited
+	 * to the given area, using the composites of retained layers.
+	 */
+	void paintLayers(size_t numLayers, Surface& s, SDL_Rect const& area);
+
+	/**
+	 * Returns the composite of the given retained layer, after repainting
+	 * the parts of it that are out of date.
+	 */
+	Surface& getComposite(size_t i);
+
 	/*!
 	Retrieves the free disk space on the sd
 	@return String containing a human readable representation of the free disk space
@@ -156,9 +191,15 @@ public:
 	//Configuration settings
 	bool useSelectionPng;
 	void setSkin(const std::string &skin, bool setWallpaper = true);
-	bool readSkinConfig(const std::string& conffile);
+	/**
+	 * Reads the settings of the skin in the given directory, from its
+	 * compiled bundle or its skin.conf. Returns false if it has neither.
+	 */
+	bool readSkinConfig(const std::string& skinDir);
 
 	SurfaceCollection sc;
+	/** Parsed link files and package metadata, kept between runs. */
+	LinkIndex linkIndex;
 	Translator tr;
 	std::unique_ptr<OutputSurface> s;
 	/** Background with empty top and bottom bar. */
@@ -207,7 +248,7 @@ public:
 
 	int drawButton(Surface& s, const std::string &btn, const std::string &text, int x=5, int y=-10);
 	int drawButtonRight(Surface& s, const std::string &btn, const std::string &text, int x=5, int y=-10);
-	void drawScrollBar(uint pageSize, uint totalSize, uint pagePos);
+	void drawScrollBar(Surface& s, uint pageSize, uint totalSize, uint pagePos);
 
 	void drawTopBar(Surface& s);
 	void drawBottomBar(Surface& s);
@@ -0,0 +1,139 @@
+// Various authors.
+// License: GPL version 2 or later.
+
+#include "iconatlas.h"
+
+#include "debug.h"
+
+#include <SDL.h>
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+/* Large enough for 64 icons of 32x32 pixels. */
+static const int PAGE_SIZE = 256;
+
+struct IconAtlas::Page {
+	unique_ptr<OffscreenSurface> surface;
+	/** Areas of destroyed views, to be reused. */
+	vector<SDL_Rect> freeSlots;
+	/** Shelf packing: icons are placed in rows, left to right. */
+	int shelfY, shelfHeight, shelfX;
+};
+
+IconAtlas::IconAtlas()
+{
+}
+
+static bool sameFormat(SDL_Surface const *a, SDL_Surface const *b) {
+	SDL_PixelFormat const& fa = *a->format, &fb = *b->format;
+	return fa.BitsPerPixel == fb.BitsPerPixel
+			&& fa.Rmask == fb.Rmask && fa.Gmask == fb.Gmask
+			&& fa.Bmask == fb.Bmask && fa.Amask == fb.Amask;
+}
+
+bool IconAtlas::allocate(Page &page, int w, int h, SDL_Rect &rect) {
+	// Reuse the smallest free slot the icon fits in.
+	auto best = page.freeSlots.end();
+	for (auto it = page.freeSlots.begin(); it != page.freeSlots.end(); ++it) {
+		if (it->w >= w && it->h >= h && (best == page.freeSlots.end()
+				|| it->w * it->h < best->w * best->h)) {
+			best = it;
+		}
+	}
+	if (best != page.freeSlots.end()) {
+		rect = *best;
+		page.freeSlots.erase(best);
+		return true;
+	}
+
+	if (page.shelfX + w > PAGE_SIZE || h > page.shelfHeight) {
+		// Start a new shelf below the current one.
+		const int y = page.shelfY + page.shelfHeight;
+		if (y + h > PAGE_SIZE) {
+			return false;
+		}
+		page.shelfY = y;
+		page.shelfX = 0;
+		page.shelfHeight = h;
+	}
+	rect = (SDL_Rect) {
+		static_cast<Sint16>(page.shelfX), static_cast<Sint16>(page.shelfY),
+		static_cast<Uint16>(w), static_cast<Uint16>(h)
+	};
+	page.shelfX += w;
+	return true;
+}
+
+shared_ptr<OffscreenSurface> IconAtlas::add(OffscreenSurface const& icon) {
+	SDL_Surface *src = icon.raw;
+	if (src->w > MAX_ICON_SIZE || src->h > MAX_ICON_SIZE
+			|| (src->flags & SDL_SRCCOLORKEY) || SDL_MUSTLOCK(src)) {
+		return nullptr;
+	}
+
+	// Find a page with the same pixel format that has room.
+	shared_ptr<Page> page;
+	SDL_Rect rect;
+	for (auto it = pages.begin(); it != pages.end() && !page; ) {
+		shared_ptr<Page> candidate = it->lock();
+		if (!candidate) {
+			it = pages.erase(it);
+			continue;
+		}
+		if (candidate->surface->premultiplied == icon.premultiplied
+				&& sameFormat(candidate->surface->raw, src)
+				&& allocate(*candidate, src->w, src->h, rect)) {
+			page = candidate;
+		}
+		++it;
+	}
+	if (!page) {
+		SDL_PixelFormat const& format = *src->format;
+		SDL_Surface *raw = SDL_CreateRGBSurface(SDL_SWSURFACE,
+				PAGE_SIZE, PAGE_SIZE, format.BitsPerPixel,
+				format.Rmask, format.Gmask, format.Bmask, format.Amask);
+		if (!raw) {
+			return nullptr;
+		}
+		page = make_shared<Page>();
+		page->surface.reset(new OffscreenSurface(raw, icon.premultiplied));
+		page->shelfY = page->shelfHeight = page->shelfX = 0;
+		allocate(*page, src->w, src->h, rect);
+		pages.push_back(page);
+		DEBUG("Allocated icon atlas page %zu\n", pages.size());
+	}
+
+	SDL_Surface *dst = page->surface->raw;
+	const int bpp = dst->format->BytesPerPixel;
+	Uint8 *pixels = static_cast<Uint8 *>(dst->pixels)
+			+ rect.y * dst->pitch + rect.x * bpp;
+	for (int y = 0; y < src->h; y++) {
+		memcpy(pixels + y * dst->pitch,
+				static_cast<const Uint8 *>(src->pixels) + y * src->pitch,
+				src->w * bpp);
+	}
+
+	SDL_PixelFormat const& format = *dst->format;
+	SDL_Surface *raw = SDL_CreateRGBSurfaceFrom(pixels, src->w, src->h,
+			format.BitsPerPixel, dst->pitch,
+			format.Rmask, format.Gmask, format.Bmask, format.Amask);
+	if (!raw) {
+		page->freeSlots.push_back(rect);
+		return nullptr;
+	}
+
+	// The view keeps its page alive and hands back its area when destroyed.
+	return shared_ptr<OffscreenSurface>(
+			new OffscreenSurface(raw, icon.premultiplied),
+			[page, rect](OffscreenSurface *view) {
+				delete view;
+				page->freeSlots.push_back(rect);
+			});
+}
+
+size_t IconAtlas::pageCount() {
+	return count_if(pages.begin(), pages.end(),
+			[](weak_ptr<Page> const& page) { return !page.expired(); });
+}
@@ -0,0 +1,50 @@
+// Various authors.
+// License: GPL version 2 or later.
+
+#ifndef ICONATLAS_H
+#define ICONATLAS_H
+
+#include "surface.h"
+
+#include <memory>
+#include <vector>
+
+/**
+ * Packs small images into shared pages, so that hundreds of icons do not
+ * each need a separately allocated surface and drawing a grid of icons reads
+ * from a few contiguous blocks of memory.
+ *
+ * A packed image is a view on a part of a page: a surface of its own that
+ * shares the page's pixels. A page stays allocated while any view on it
+ * exists; the space of a view is reused once the view is destroyed.
+ */
+class IconAtlas {
+public:
+	/** The largest width and height of an image that is packed. */
+	static const int MAX_ICON_SIZE = 64;
+
+	IconAtlas();
+
+	/**
+	 * Copies the given image into a page and returns a view on it, or
+	 * returns nullptr if the image cannot be packed. Images that are
+	 * larger than MAX_ICON_SIZE or have a color key are not packed.
+	 */
+	std::shared_ptr<OffscreenSurface> add(OffscreenSurface const& icon);
+
+	/** Returns the number of pages that are currently allocated. */
+	size_t pageCount();
+
+private:
+	struct Page;
+
+	/**
+	 * Reserves an area of the given size in the given page. Returns false
+	 * if the page is full.
+	 */
+	static bool allocate(Page &page, int w, int h, SDL_Rect &rect);
+
+	std::vector<std::weak_ptr<Page>> pages;
+};
+
+#endif
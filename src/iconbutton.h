@@ -37,7 +37,7 @@ private:
 	Action action;
 
 	SDL_Rect rect, iconRect, labelRect;
-	OffscreenSurface *iconSurface;
+	std::shared_ptr<OffscreenSurface> iconSurface;
 };
 
 #endif
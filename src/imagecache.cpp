@@ -0,0 +1,272 @@
+// Various authors.
+// License: GPL version 2 or later.
+
+#include "imagecache.h"
+
+#include "debug.h"
+
+#include <SDL.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+/**
+ * Start of a cache file. It is followed by the key, the path of the source
+ * file and, at the next multiple of 16 bytes, the pixels: height rows of
+ * pitch bytes.
+ */
+struct Header {
+	char magic[4];
+	uint32_t version;
+	int64_t sourceTime;
+	uint64_t sourceSize;
+	uint32_t keyLength, pathLength;
+	uint32_t format;
+	uint32_t width, height, pitch;
+	uint32_t bitsPerPixel;
+	uint32_t masks[4];
+	uint32_t colorKey;
+	uint32_t screenBitsPerPixel;
+	uint32_t screenMasks[3];
+};
+
+}
+
+static const char MAGIC[4] = { 'G', 'M', 'I', 'C' };
+static const uint32_t VERSION = 2;
+
+static size_t pixelOffset(size_t keyLength, size_t pathLength) {
+	return (sizeof(Header) + keyLength + pathLength + 15) & ~size_t(15);
+}
+
+static bool statSource(string const& path, struct stat &st) {
+#ifdef HAVE_LIBOPK
+	string::size_type pos = path.find('#');
+	if (pos != path.npos) {
+		return stat(path.substr(0, pos).c_str(), &st) == 0;
+	}
+#endif
+	return stat(path.c_str(), &st) == 0;
+}
+
+ImageCache::ImageCache(string const& dir)
+	: dir(dir)
+{
+}
+
+string ImageCache::cacheFile(string const& key) {
+	// FNV-1a; collisions are caught by the key stored in the file.
+	uint64_t hash = 14695981039346656037ULL;
+	for (char c : key) {
+		hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+	}
+	char name[24];
+	snprintf(name, sizeof(name), "%016llx.img",
+			static_cast<unsigned long long>(hash));
+	return dir + "/" + name;
+}
+
+unique_ptr<OffscreenSurface> ImageCache::load(string const& key,
+		string const& path, OffscreenSurface::Format &format)
+{
+	SDL_Surface *screen = SDL_GetVideoSurface();
+	struct stat source;
+	if (!screen || !statSource(path, source)) {
+		return nullptr;
+	}
+
+	int fd = open(cacheFile(key).c_str(), O_RDONLY);
+	if (fd < 0) {
+		return nullptr;
+	}
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(Header)) {
+		map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (map == MAP_FAILED) {
+		return nullptr;
+	}
+
+	const char *data = static_cast<const char *>(map);
+	const size_t size = st.st_size;
+	Header header;
+	memcpy(&header, data, sizeof(header));
+	SDL_PixelFormat const& sf = *screen->format;
+	const bool valid = !memcmp(header.magic, MAGIC, sizeof(MAGIC))
+			&& header.version == VERSION
+			&& header.sourceTime == source.st_mtime
+			&& header.sourceSize == (uint64_t) source.st_size
+			&& header.keyLength == key.size()
+			&& header.pathLength == path.size()
+			&& header.format <= (uint32_t) OffscreenSurface::Format::ORIGINAL
+			&& header.screenBitsPerPixel == sf.BitsPerPixel
+			&& header.screenMasks[0] == sf.Rmask
+			&& header.screenMasks[1] == sf.Gmask
+			&& header.screenMasks[2] == sf.Bmask
+			&& size >= pixelOffset(key.size(), path.size())
+					+ (size_t) header.pitch * header.height
+			&& !memcmp(data + sizeof(header), key.data(), key.size());
+
+	SDL_Surface *raw = nullptr;
+	if (valid) {
+		raw = SDL_CreateRGBSurface(
+				SDL_SWSURFACE | (header.masks[3] ? SDL_SRCALPHA : 0),
+				header.width, header.height, header.bitsPerPixel,
+				header.masks[0], header.masks[1], header.masks[2],
+				header.masks[3]);
+	}
+	if (raw) {
+		const char *pixels = data + pixelOffset(key.size(), path.size());
+		const size_t rowBytes = min<size_t>(header.pitch, raw->pitch);
+		for (uint32_t y = 0; y < header.height; y++) {
+			memcpy(static_cast<char *>(raw->pixels) + y * raw->pitch,
+					pixels + y * header.pitch, rowBytes);
+		}
+	}
+	munmap(map, size);
+	if (!raw) {
+		return nullptr;
+	}
+
+	format = static_cast<OffscreenSurface::Format>(header.format);
+	if (format == OffscreenSurface::Format::COLOR_KEY) {
+		SDL_SetColorKey(raw, SDL_SRCCOLORKEY | SDL_RLEACCEL, header.colorKey);
+	}
+	DEBUG("Loaded '%s' from the image cache\n", key.c_str());
+	return unique_ptr<OffscreenSurface>(new OffscreenSurface(
+			raw, format == OffscreenSurface::Format::PREMULTIPLIED));
+}
+
+void ImageCache::store(string const& key, string const& path,
+		OffscreenSurface const& surface, OffscreenSurface::Format format)
+{
+	SDL_Surface *screen = SDL_GetVideoSurface();
+	struct stat source;
+	if (!screen || !statSource(path, source)) {
+		return;
+	}
+	if (mkdir(dir.c_str(), 0770) < 0 && errno != EEXIST) {
+		WARNING("Unable to create image cache directory '%s'\n", dir.c_str());
+		return;
+	}
+
+	SDL_Surface *raw = surface.raw;
+	Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.sourceTime = source.st_mtime;
+	header.sourceSize = source.st_size;
+	header.keyLength = key.size();
+	header.pathLength = path.size();
+	header.format = static_cast<uint32_t>(format);
+	header.width = raw->w;
+	header.height = raw->h;
+	header.pitch = raw->pitch;
+	header.bitsPerPixel = raw->format->BitsPerPixel;
+	header.masks[0] = raw->format->Rmask;
+	header.masks[1] = raw->format->Gmask;
+	header.masks[2] = raw->format->Bmask;
+	header.masks[3] = raw->format->Amask;
+	header.colorKey = raw->format->colorkey;
+	header.screenBitsPerPixel = screen->format->BitsPerPixel;
+	header.screenMasks[0] = screen->format->Rmask;
+	header.screenMasks[1] = screen->format->Gmask;
+	header.screenMasks[2] = screen->format->Bmask;
+
+	// Write to a temporary file first, so a concurrent or interrupted run
+	// never sees a partially written image.
+	const string file = cacheFile(key);
+	const string tmp = file + ".tmp";
+	FILE *fp = fopen(tmp.c_str(), "wb");
+	if (!fp) {
+		return;
+	}
+	static const char padding[16] = { 0 };
+	const size_t padLength = pixelOffset(key.size(), path.size())
+			- sizeof(header) - key.size() - path.size();
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1
+			&& fwrite(key.data(), 1, key.size(), fp) == key.size()
+			&& fwrite(path.data(), 1, path.size(), fp) == path.size()
+			&& fwrite(padding, 1, padLength, fp) == padLength;
+	// Locking also undoes RLE acceleration, if it was applied already.
+	if (ok && (!SDL_MUSTLOCK(raw) || SDL_LockSurface(raw) == 0)) {
+		const size_t pixelBytes = (size_t) raw->pitch * raw->h;
+		ok = fwrite(raw->pixels, 1, pixelBytes, fp) == pixelBytes;
+		if (SDL_MUSTLOCK(raw)) {
+			SDL_UnlockSurface(raw);
+		}
+	} else {
+		ok = false;
+	}
+	ok = fclose(fp) == 0 && ok;
+
+	if (!ok || rename(tmp.c_str(), file.c_str()) < 0) {
+		WARNING("Unable to write image cache file '%s'\n", file.c_str());
+		unlink(tmp.c_str());
+	}
+}
+
+/* Returns whether the given cache file can never be loaded again. */
+static bool isOrphaned(string const& file) {
+	int fd = open(file.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	Header header;
+	string path;
+	struct stat st;
+	bool orphaned = fstat(fd, &st) < 0
+			|| read(fd, &header, sizeof(header)) != sizeof(header)
+			|| memcmp(header.magic, MAGIC, sizeof(MAGIC))
+			|| header.version != VERSION
+			// The lengths are only trusted once they fit in the file.
+			|| (uint64_t) sizeof(header) + header.keyLength + header.pathLength
+					> (uint64_t) st.st_size;
+	if (!orphaned) {
+		path.resize(header.pathLength);
+		orphaned = pread(fd, &path[0], path.size(),
+				sizeof(header) + header.keyLength) != (ssize_t) path.size();
+	}
+	close(fd);
+
+	struct stat source;
+	return orphaned || !statSource(path, source)
+			|| header.sourceTime != source.st_mtime
+			|| header.sourceSize != (uint64_t) source.st_size;
+}
+
+void ImageCache::prune() {
+	DIR *dirp = opendir(dir.c_str());
+	if (!dirp) {
+		return;
+	}
+	unsigned int removed = 0;
+	while (struct dirent *dptr = readdir(dirp)) {
+		// Other files, such as the link index, share the directory.
+		const string name = dptr->d_name;
+		if (name.size() < 4 || name.compare(name.size() - 4, 4, ".img")) {
+			continue;
+		}
+		// An image stored concurrently replaces an orphan atomically, in which
+		// case unlinking may remove the new file; that only costs a reload.
+		const string file = dir + "/" + name;
+		if (isOrphaned(file) && unlink(file.c_str()) == 0) {
+			removed++;
+		}
+	}
+	closedir(dirp);
+	DEBUG("Removed %u orphaned files from the image cache\n", removed);
+}
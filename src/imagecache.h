@@ -0,0 +1,57 @@
+// Various authors.
+// License: GPL version 2 or later.
+
+#ifndef IMAGECACHE_H
+#define IMAGECACHE_H
+
+#include "surface.h"
+
+#include <memory>
+#include <string>
+
+/**
+ * Persistent cache of decoded images, as converted for the display.
+ * An image that did not change since it was cached is loaded by copying the
+ * pixels from its cache file into a new surface: no decompression and no
+ * color conversion, but still one copy of the image.
+ *
+ * Each image gets a file of its own in the cache directory. A cached image
+ * is valid as long as the size and modification time of its source file and
+ * the pixel format of the screen are those it was stored with.
+ */
+class ImageCache {
+public:
+	ImageCache(std::string const& dir);
+
+	/**
+	 * Loads a cached image.
+	 * @param key Identifies the image; usually the path of its source file.
+	 * @param path The source file; for an icon inside an OPK package, the
+	 *             package path followed by '#' and the icon path.
+	 * @param format Set to the format the image was stored in.
+	 * @return The image, or nullptr if the cache has no valid copy of it.
+	 */
+	std::unique_ptr<OffscreenSurface> load(std::string const& key,
+			std::string const& path, OffscreenSurface::Format &format);
+
+	/**
+	 * Stores an image that was loaded from the given path and converted
+	 * for the display. Nothing is stored before the video mode is set.
+	 */
+	void store(std::string const& key, std::string const& path,
+			OffscreenSurface const& surface, OffscreenSurface::Format format);
+
+	/**
+	 * Removes the cache files that can never be valid again: those of an
+	 * older cache version and those of which the source file was removed
+	 * or changed since. Safe to call on a background thread.
+	 */
+	void prune();
+
+private:
+	std::string cacheFile(std::string const& key);
+
+	std::string dir;
+};
+
+#endif
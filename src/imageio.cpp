@@ -6,36 +6,316 @@
 
 #include "imageio.h"
 
+#include "blend.h"
 #include "debug.h"
 
 #include <SDL.h>
 #include <png.h>
+#include <algorithm>
 #include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #ifdef HAVE_LIBOPK
 #include <opk.h>
+#endif
+
+static const uint8_t PNG_MAGIC[4] = { 0x89, 'P', 'N', 'G' };
+static const uint8_t QOI_MAGIC[4] = { 'q', 'o', 'i', 'f' };
+
+/* Where PNG data is read from if it is in memory, such as a file that was
+ * extracted from an OPK. */
+struct MemoryReader {
+	const uint8_t *pos, *end;
+};
 
-static void __readFromOpk(png_structp png_ptr, png_bytep ptr, png_size_t length)
+static void readFromMemory(png_structp png_ptr, png_bytep ptr, png_size_t length)
 {
-	char **buf = (char **) png_get_io_ptr(png_ptr);
+	MemoryReader *reader = (MemoryReader *) png_get_io_ptr(png_ptr);
+	if (length > (size_t) (reader->end - reader->pos)) {
+		png_error(png_ptr, "Read beyond end of data");
+	}
 
-	memcpy(ptr, *buf, length);
-	*buf += length;
+	memcpy(ptr, reader->pos, length);
+	reader->pos += length;
 }
-#endif
 
-SDL_Surface *loadPNG(const std::string &path, bool loadAlpha) {
+/* Thresholds for ordered dithering, in sixteenths. */
+static const uint32_t bayer4[4][4] = {
+	{  0,  8,  2, 10 },
+	{ 12,  4, 14,  6 },
+	{  3, 11,  1,  9 },
+	{ 15,  7, 13,  5 },
+};
+
+/* Converts row y of an image from ARGB to a 16bpp or 32bpp format. */
+static void convertRow(const uint32_t *src, uint8_t *dst, png_uint_32 width,
+		SDL_PixelFormat const& format, png_uint_32 y, bool dither)
+{
+	const uint32_t *thresholds = bayer4[y & 3];
+	for (png_uint_32 x = 0; x < width; x++) {
+		const uint32_t p = src[x];
+		uint32_t r = (p >> 16) & 0xFF, g = (p >> 8) & 0xFF, b = p & 0xFF;
+		if (dither) {
+			const uint32_t t = thresholds[x & 3];
+			r = std::min<uint32_t>(r + ((t << format.Rloss) >> 4), 255);
+			g = std::min<uint32_t>(g + ((t << format.Gloss) >> 4), 255);
+			b = std::min<uint32_t>(b + ((t << format.Bloss) >> 4), 255);
+		}
+		uint32_t pixel = (r >> format.Rloss) << format.Rshift
+				| (g >> format.Gloss) << format.Gshift
+				| (b >> format.Bloss) << format.Bshift;
+		if (format.Amask) {
+			pixel |= (p >> 24 >> format.Aloss) << format.Ashift;
+		}
+		if (format.BytesPerPixel == 2) {
+			reinterpret_cast<uint16_t *>(dst)[x] = pixel;
+		} else {
+			reinterpret_cast<uint32_t *>(dst)[x] = pixel;
+		}
+	}
+}
+
+/* Shrinks an image that is fed to it row by row, top to bottom: each
+ * destination pixel is the average of the source area it covers. The
+ * average is taken of premultiplied components, so that the color of
+ * transparent pixels does not bleed into their neighbours.
+ * Positions are counted in units of 1/dstW source pixel horizontally and
+ * 1/dstH source pixel vertically, which makes all weights integers.
+ * This is a plain struct with malloc'ed buffers, since libpng reports errors
+ * with longjmp. */
+struct Shrinker {
+	png_uint_32 srcW, srcH, dstW, dstH, srcY;
+	bool weighAlpha;
+	/* Sums of the current source row, 4 components per destination pixel. */
+	uint32_t *hrow;
+	/* Sums of the current destination row. */
+	uint64_t *acc;
+};
+
+static inline uint32_t premultiplied(uint32_t c, uint32_t a) {
+	return (c * a + 127) / 255;
+}
+
+static void emitRow(Shrinker &s, png_uint_32 y, SDL_Surface *dst,
+		bool premultiply)
+{
+	const uint64_t total = (uint64_t) s.srcW * s.srcH;
+	uint32_t *out = reinterpret_cast<uint32_t *>(
+			static_cast<uint8_t *>(dst->pixels) + y * dst->pitch);
+	for (png_uint_32 x = 0; x < s.dstW; x++) {
+		uint64_t *sum = &s.acc[x * 4];
+		uint32_t c[4];
+		for (int k = 0; k < 4; k++) {
+			c[k] = (sum[k] + total / 2) / total;
+			sum[k] = 0;
+		}
+		if (s.weighAlpha && !premultiply) {
+			for (int k = 1; k < 4; k++) {
+				c[k] = c[0] ? std::min<uint32_t>((c[k] * 255 + c[0] / 2) / c[0], 255) : 0;
+			}
+		}
+		out[x] = c[0] << 24 | c[1] << 16 | c[2] << 8 | c[3];
+	}
+}
+
+static void shrinkRow(Shrinker &s, const uint32_t *src, SDL_Surface *dst,
+		bool premultiply)
+{
+	memset(s.hrow, 0, s.dstW * 4 * sizeof(uint32_t));
+	for (png_uint_32 x = 0; x < s.srcW; x++) {
+		const uint32_t p = src[x];
+		const uint32_t a = s.weighAlpha ? p >> 24 : 255;
+		const uint32_t c[4] = {
+			a,
+			premultiplied((p >> 16) & 0xFF, a),
+			premultiplied((p >> 8) & 0xFF, a),
+			premultiplied(p & 0xFF, a),
+		};
+		uint64_t start = (uint64_t) x * s.dstW;
+		const uint64_t end = start + s.dstW;
+		png_uint_32 i = start / s.srcW;
+		while (start < end) {
+			const uint64_t boundary = (uint64_t) (i + 1) * s.srcW;
+			const uint32_t weight = std::min(end, boundary) - start;
+			uint32_t *sum = &s.hrow[i * 4];
+			for (int k = 0; k < 4; k++) {
+				sum[k] += c[k] * weight;
+			}
+			start += weight;
+			if (start == boundary) i++;
+		}
+	}
+
+	uint64_t start = (uint64_t) s.srcY * s.dstH;
+	const uint64_t end = start + s.dstH;
+	png_uint_32 j = start / s.srcH;
+	while (start < end) {
+		const uint64_t boundary = (uint64_t) (j + 1) * s.srcH;
+		const uint32_t weight = std::min(end, boundary) - start;
+		for (png_uint_32 k = 0; k < s.dstW * 4; k++) {
+			s.acc[k] += (uint64_t) s.hrow[k] * weight;
+		}
+		start += weight;
+		if (start == boundary) {
+			emitRow(s, j++, dst, premultiply);
+		}
+	}
+	s.srcY++;
+}
+
+/* How an image should be decoded; see loadImageFile(). */
+struct DecodeOptions {
+	bool loadAlpha, premultiply;
+	/* Decode into a 32bpp [A]RGB surface if NULL, or else into a surface of
+	 * this format, which must be 16bpp or 32bpp. */
+	SDL_PixelFormat const* format;
+	bool dither;
+	/* If not zero, a 32bpp [A]RGB image that does not fit in this size is
+	 * shrunk to fit while preserving its aspect ratio. */
+	png_uint_32 maxWidth, maxHeight;
+};
+
+/* Receives a decoded image row by row, as 32bpp ARGB, and stores it in a
+ * surface as requested by the decode options. This is shared by all image
+ * formats, and like Shrinker, it is a plain struct. */
+struct RowSink {
+	SDL_Surface *surface;
+	SDL_PixelFormat const* format;
+	bool premultiply, dither, shrinking;
+	Shrinker shrink;
+};
+
+/* Allocates the surface for an image of the given size.
+ * Returns false on failure; the sink must be freed with freeSink() either
+ * way. */
+static bool openSink(RowSink &sink, DecodeOptions const& options,
+		png_uint_32 width, png_uint_32 height)
+{
+	// Refuse to load outrageously large images.
+	if (width > 65536) {
+		WARNING("Refusing to load image because it is too wide\n");
+		return false;
+	}
+	if (height > 2048) {
+		WARNING("Refusing to load image because it is too high\n");
+		return false;
+	}
+
+	sink.format = options.format;
+	sink.premultiply = options.loadAlpha && options.premultiply;
+	sink.dither = options.dither;
+
+	// Fit the image in the maximum size, if it is too large.
+	Shrinker &shrink = sink.shrink;
+	shrink.srcW = shrink.dstW = width;
+	shrink.srcH = shrink.dstH = height;
+	if (!sink.format && options.maxWidth && options.maxHeight
+			&& (width > options.maxWidth || height > options.maxHeight)) {
+		const png_uint_32 maxWidth = options.maxWidth;
+		const png_uint_32 maxHeight = options.maxHeight;
+		if ((uint64_t) width * maxHeight > (uint64_t) height * maxWidth) {
+			shrink.dstW = maxWidth;
+			shrink.dstH = std::max<png_uint_32>(
+					(uint64_t) height * maxWidth / width, 1);
+		} else {
+			shrink.dstH = maxHeight;
+			shrink.dstW = std::max<png_uint_32>(
+					(uint64_t) width * maxHeight / height, 1);
+		}
+		shrink.weighAlpha = options.loadAlpha;
+		shrink.hrow = static_cast<uint32_t *>(
+				malloc(shrink.dstW * 4 * sizeof(uint32_t)));
+		shrink.acc = static_cast<uint64_t *>(
+				calloc(shrink.dstW * 4, sizeof(uint64_t)));
+		if (!shrink.hrow || !shrink.acc) return false;
+	}
+	sink.shrinking = shrink.dstW != width || shrink.dstH != height;
+
+	if (sink.format) {
+		// Allocate a surface in the requested format.
+		sink.surface = SDL_CreateRGBSurface(
+			SDL_SWSURFACE, width, height, sink.format->BitsPerPixel,
+			sink.format->Rmask, sink.format->Gmask, sink.format->Bmask,
+			sink.format->Amask
+			);
+	} else {
+		// Allocate [A]RGB surface to hold the image.
+		sink.surface = SDL_CreateRGBSurface(
+			SDL_SWSURFACE | SDL_SRCALPHA, shrink.dstW, shrink.dstH, 32,
+			0x00FF0000, 0x0000FF00, 0x000000FF,
+			options.loadAlpha ? 0xFF000000 : 0x00000000
+			);
+	}
+	// If this failed, we are probably out of memory.
+	return sink.surface != NULL;
+}
+
+/* Returns the row of the surface that row y of the image can be decoded into
+ * directly, or NULL if rows must be passed to storeRow() instead. */
+static uint32_t *sinkRow(RowSink &sink, png_uint_32 y)
+{
+	if (sink.format || sink.shrinking) {
+		return NULL;
+	}
+	return reinterpret_cast<uint32_t *>(
+			static_cast<uint8_t *>(sink.surface->pixels)
+			+ y * sink.surface->pitch);
+}
+
+/* Stores row y of the image; rows must be stored top to bottom. */
+static void storeRow(RowSink &sink, const uint32_t *row, png_uint_32 y)
+{
+	if (sink.format) {
+		convertRow(row,
+			static_cast<uint8_t *>(sink.surface->pixels)
+				+ y * sink.surface->pitch,
+			sink.shrink.srcW, *sink.format, y, sink.dither);
+	} else {
+		shrinkRow(sink.shrink, row, sink.surface, sink.premultiply);
+	}
+}
+
+/* Returns the surface once all rows have been stored; the sink no longer
+ * owns it. */
+static SDL_Surface *finishSink(RowSink &sink)
+{
+	SDL_Surface *surface = sink.surface;
+	// Shrinking premultiplies already.
+	if (!sink.format && !sink.shrinking && sink.premultiply) {
+		premultiplyAlpha(static_cast<uint8_t *>(surface->pixels),
+				surface->pitch, surface->w, surface->h);
+	}
+	sink.surface = NULL;
+	return surface;
+}
+
+static void freeSink(RowSink &sink)
+{
+	if (sink.surface) {
+		SDL_FreeSurface(sink.surface);
+	}
+	free(sink.shrink.hrow);
+	free(sink.shrink.acc);
+}
+
+/* Decodes a PNG image from the given file, of which the first 4 bytes have
+ * been read already, or if fp is NULL, from memory. */
+static SDL_Surface *decodePNG(FILE *fp, MemoryReader *reader,
+		DecodeOptions const& options)
+{
 	// Declare these with function scope and initialize them to NULL,
 	// so we can use a single cleanup block at the end of the function.
-	SDL_Surface *surface = NULL;
-	FILE *fp = NULL;
+	// The pointers assigned after setjmp() must not be kept in registers,
+	// or the cleanup after a longjmp() might see stale values.
+	SDL_Surface *volatile surface = NULL;
+	RowSink sink = RowSink();
 	png_structp png = NULL;
 	png_infop info = NULL;
-#ifdef HAVE_LIBOPK
-	std::string::size_type pos;
-	struct OPK *opk = NULL;
-	void *buffer = NULL, *param;
-#endif
+	png_bytep volatile rowBuffer = NULL;
+	int passes;
 
 	// Create and initialize the top-level libpng struct.
 	png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
@@ -46,46 +326,15 @@ SDL_Surface *loadPNG(const std::string &path, bool loadAlpha) {
 	// Setup error handling for errors detected by libpng.
 	if (setjmp(png_jmpbuf(png))) {
 		// Note: This gets executed when an error occurs.
-		if (surface) {
-			SDL_FreeSurface(surface);
-			surface = NULL;
-		}
 		goto cleanup;
 	}
 
-#ifdef HAVE_LIBOPK
-	pos = path.find('#');
-	if (pos != path.npos) {
-		int ret;
-		size_t length;
-
-		DEBUG("Registering specific callback for icon %s\n", path.c_str());
-
-		opk = opk_open(path.substr(0, pos).c_str());
-		if (!opk) {
-			ERROR("Unable to open OPK\n");
-			goto cleanup;
-		}
-
-		ret = opk_extract_file(opk, path.substr(pos + 1).c_str(),
-					&buffer, &length);
-		if (ret < 0) {
-			ERROR("Unable to extract icon from OPK\n");
-			goto cleanup;
-		}
-
-		param = buffer;
-
-		png_set_read_fn(png, &param, __readFromOpk);
-	} else {
-#else
-	if (1) {
-#endif /* HAVE_LIBOPK */
-		fp = fopen(path.c_str(), "rb");
-		if (!fp) goto cleanup;
-
+	if (fp) {
 		// Set up the input control if you are using standard C streams.
 		png_init_io(png, fp);
+		png_set_sig_bytes(png, sizeof(PNG_MAGIC));
+	} else {
+		png_set_read_fn(png, reader, readFromMemory);
 	}
 
 	// The call to png_read_info() gives us all of the information from the
@@ -117,6 +366,9 @@ SDL_Surface *loadPNG(const std::string &path, bool loadAlpha) {
 		png_set_bgr(png); // BGRA in memory becomes ARGB in register
 	}
 
+	// - deinterlace
+	passes = png_set_interlace_handling(png);
+
 	// Update the image info to the post-conversion state.
 	png_read_update_info(png, info);
 	png_get_IHDR(
@@ -124,54 +376,258 @@ SDL_Surface *loadPNG(const std::string &path, bool loadAlpha) {
 	assert(bitDepth == 8);
 	assert(colorType == PNG_COLOR_TYPE_RGB_ALPHA);
 
-	// Refuse to load outrageously large images.
-	if (width > 65536) {
-		WARNING("Refusing to load image because it is too wide\n");
-		goto cleanup;
-	}
-	if (height > 2048) {
-		WARNING("Refusing to load image because it is too high\n");
-		goto cleanup;
-	}
-
-	// Allocate [A]RGB surface to hold the image.
-	surface = SDL_CreateRGBSurface(
-		SDL_SWSURFACE | SDL_SRCALPHA, width, height, 32,
-		0x00FF0000, 0x0000FF00, 0x000000FF, loadAlpha ? 0xFF000000 : 0x00000000
-		);
-	if (!surface) {
-		// Failed to create surface, probably out of memory.
-		goto cleanup;
+	if (!openSink(sink, options, width, height)) goto cleanup;
+	if (!sinkRow(sink, 0)) {
+		// Rows are converted one by one from a buffer of one ARGB row;
+		// interlaced images need all rows.
+		rowBuffer = static_cast<png_bytep>(
+			malloc(width * 4 * (passes > 1 ? height : 1)));
+		if (!rowBuffer) goto cleanup;
 	}
 
 	// Note: GCC 4.9 doesn't want to jump over 'rowPointers' with goto
 	//       if it is in the outer scope.
-	{
+	if (!rowBuffer || passes > 1) {
 		// Compute row pointers.
 		png_bytep rowPointers[height];
 		for (png_uint_32 y = 0; y < height; y++) {
-			rowPointers[y] =
-				static_cast<png_bytep>(surface->pixels) + y * surface->pitch;
+			rowPointers[y] = rowBuffer
+				? rowBuffer + y * width * 4
+				: reinterpret_cast<png_bytep>(sinkRow(sink, y));
 		}
 
 		// Read the entire image in one go.
 		png_read_image(png, rowPointers);
 	}
+	if (rowBuffer) {
+		for (png_uint_32 y = 0; y < height; y++) {
+			png_bytep row = rowBuffer;
+			if (passes > 1) {
+				row += y * width * 4;
+			} else {
+				png_read_row(png, row, NULL);
+			}
+			storeRow(sink, reinterpret_cast<const uint32_t *>(row), y);
+		}
+	}
 
 	// Read rest of file, and get additional chunks in the info struct.
 	// Note: We got all we need, so skip this step.
 	//png_read_end(png, info);
 
+	surface = finishSink(sink);
+
 cleanup:
 	// Clean up.
 	png_destroy_read_struct(&png, &info, NULL);
-	if (fp) fclose(fp);
+	free(rowBuffer);
+	freeSink(sink);
+
+	return surface;
+}
+
+static inline uint32_t readBigEndian32(const uint8_t *p)
+{
+	return (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/* Decodes an image in the "Quite OK Image" format (https://qoiformat.org/).
+ * QOI files are somewhat larger than PNG files, but decode several times
+ * faster, since each pixel is a small delta from the previous one or a
+ * lookup in a table of recent colors, without further compression. */
+static SDL_Surface *decodeQOI(const uint8_t *data, size_t size,
+		DecodeOptions const& options)
+{
+	// A 14 byte header, the pixel data and an 8 byte end marker.
+	static const size_t HEADER_SIZE = 14, END_SIZE = 8;
+	if (size < HEADER_SIZE + END_SIZE) {
+		WARNING("Refusing to load truncated QOI image\n");
+		return NULL;
+	}
+	const png_uint_32 width = readBigEndian32(data + 4);
+	const png_uint_32 height = readBigEndian32(data + 8);
+	const uint8_t channels = data[12];
+	if (width == 0 || height == 0 || (channels != 3 && channels != 4)) {
+		WARNING("Refusing to load invalid QOI image\n");
+		return NULL;
+	}
+
+	RowSink sink = RowSink();
+	uint32_t *rowBuffer = NULL;
+	SDL_Surface *surface = NULL;
+	if (!openSink(sink, options, width, height)) goto cleanup;
+	if (!sinkRow(sink, 0)) {
+		rowBuffer = static_cast<uint32_t *>(malloc(width * 4));
+		if (!rowBuffer) goto cleanup;
+	}
+
+	{
+		// A chunk is at most 5 bytes long, so reading one that starts
+		// before the end marker stays inside the data.
+		const uint8_t *p = data + HEADER_SIZE;
+		const uint8_t *const end = data + size - END_SIZE;
+		uint32_t index[64] = { 0 };
+		uint8_t r = 0, g = 0, b = 0, a = 255;
+		uint32_t pixel = 0xFF000000;
+		unsigned int run = 0;
+		for (png_uint_32 y = 0; y < height; y++) {
+			uint32_t *row = rowBuffer ? rowBuffer : sinkRow(sink, y);
+			for (png_uint_32 x = 0; x < width; x++) {
+				if (run) {
+					run--;
+				} else if (p < end) {
+					const uint8_t op = *p++;
+					if (op == 0xFE) { // QOI_OP_RGB
+						r = p[0]; g = p[1]; b = p[2];
+						p += 3;
+					} else if (op == 0xFF) { // QOI_OP_RGBA
+						r = p[0]; g = p[1]; b = p[2]; a = p[3];
+						p += 4;
+					} else switch (op >> 6) {
+						case 0: { // QOI_OP_INDEX
+							const uint32_t c = index[op];
+							a = c >> 24; r = c >> 16; g = c >> 8; b = c;
+							break;
+						}
+						case 1: // QOI_OP_DIFF
+							r += ((op >> 4) & 3) - 2;
+							g += ((op >> 2) & 3) - 2;
+							b += (op & 3) - 2;
+							break;
+						case 2: { // QOI_OP_LUMA
+							const int dg = (op & 0x3F) - 32;
+							const uint8_t rb = *p++;
+							r += dg - 8 + (rb >> 4);
+							g += dg;
+							b += dg - 8 + (rb & 0x0F);
+							break;
+						}
+						default: // QOI_OP_RUN
+							run = op & 0x3F;
+							break;
+					}
+					pixel = (uint32_t) a << 24 | r << 16 | g << 8 | b;
+					index[(r * 3 + g * 5 + b * 7 + a * 11) & 63] = pixel;
+				}
+				row[x] = pixel;
+			}
+			if (rowBuffer) {
+				storeRow(sink, rowBuffer, y);
+			}
+		}
+	}
+
+	surface = finishSink(sink);
+
+cleanup:
+	free(rowBuffer);
+	freeSink(sink);
+
+	return surface;
+}
+
+/* Decodes an image that is in memory, in any supported format. */
+static SDL_Surface *decodeMemory(const uint8_t *data, size_t size,
+		DecodeOptions const& options)
+{
+	if (size >= sizeof(QOI_MAGIC) && !memcmp(data, QOI_MAGIC, sizeof(QOI_MAGIC))) {
+		return decodeQOI(data, size, options);
+	}
+	MemoryReader reader = { data, data + size };
+	return decodePNG(NULL, &reader, options);
+}
+
+/* Decodes an image file, in any supported format. The format is recognized
+ * by the first bytes of the file rather than by its name, so that for
+ * example a skin can replace a PNG image by a QOI image of the same name. */
+static SDL_Surface *decodeImage(const std::string &path,
+		DecodeOptions const& options)
+{
+	SDL_Surface *surface = NULL;
+	FILE *fp;
+	uint8_t magic[4];
+
 #ifdef HAVE_LIBOPK
-	if (buffer)
-		free(buffer);
-	if (opk)
+	std::string::size_type pos = path.find('#');
+	if (pos != path.npos) {
+		void *buffer;
+		size_t length;
+
+		DEBUG("Extracting image %s\n", path.c_str());
+
+		struct OPK *opk = opk_open(path.substr(0, pos).c_str());
+		if (!opk) {
+			ERROR("Unable to open OPK\n");
+			return NULL;
+		}
+
+		int ret = opk_extract_file(opk, path.substr(pos + 1).c_str(),
+					&buffer, &length);
+		if (ret < 0) {
+			ERROR("Unable to extract icon from OPK\n");
+		} else {
+			surface = decodeMemory(
+					static_cast<const uint8_t *>(buffer), length, options);
+			free(buffer);
+		}
 		opk_close(opk);
-#endif
+		return surface;
+	}
+#endif /* HAVE_LIBOPK */
 
+	fp = fopen(path.c_str(), "rb");
+	if (!fp) return NULL;
+
+	if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic)) {
+		WARNING("Unable to read image '%s'\n", path.c_str());
+	} else if (!memcmp(magic, PNG_MAGIC, sizeof(magic))) {
+		surface = decodePNG(fp, NULL, options);
+	} else if (!memcmp(magic, QOI_MAGIC, sizeof(magic))) {
+		// Decoding QOI is fast enough that reading the file through stdio
+		// would be noticeable; map it instead.
+		struct stat st;
+		void *map = MAP_FAILED;
+		if (fstat(fileno(fp), &st) == 0) {
+			map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+					fileno(fp), 0);
+		}
+		if (map != MAP_FAILED) {
+			surface = decodeQOI(
+					static_cast<const uint8_t *>(map), st.st_size, options);
+			munmap(map, st.st_size);
+		}
+	} else {
+		WARNING("Unknown format of image '%s'\n", path.c_str());
+	}
+
+	fclose(fp);
 	return surface;
 }
+
+SDL_Surface *loadImageFile(const std::string &path, bool loadAlpha,
+		bool premultiply, unsigned int maxWidth, unsigned int maxHeight)
+{
+	const DecodeOptions options = {
+		loadAlpha, premultiply, NULL, false, maxWidth, maxHeight
+	};
+	return decodeImage(path, options);
+}
+
+SDL_Surface *loadImageFile(const std::string &path,
+		SDL_PixelFormat const& format, bool dither)
+{
+	if (format.BytesPerPixel == 2 || format.BytesPerPixel == 4) {
+		const DecodeOptions options = { true, false, &format, dither, 0, 0 };
+		return decodeImage(path, options);
+	}
+
+	// Other formats are rare; let SDL convert those.
+	SDL_Surface *argb = loadImageFile(path, format.Amask != 0);
+	if (!argb) {
+		return NULL;
+	}
+	SDL_Surface *converted = SDL_ConvertSurface(
+		argb, const_cast<SDL_PixelFormat *>(&format), SDL_SWSURFACE);
+	SDL_FreeSurface(argb);
+	return converted;
+}
@@ -3,10 +3,30 @@
 
 #include <string>
 
+struct SDL_PixelFormat;
 struct SDL_Surface;
 
-/** Loads an image from a PNG file into a newly allocated 32bpp RGBA surface.
+/** Loads an image from a PNG or QOI file into a newly allocated 32bpp RGBA
+  * surface. The format is recognized by the contents of the file, not by its
+  * name. QOI images are larger than PNG images, but decode much faster.
+  * If premultiply is true, the color components are multiplied by the alpha
+  * channel while loading; this requires loadAlpha.
+  * If maxWidth and maxHeight are not zero, an image that does not fit in
+  * that box is shrunk to fit while it is decoded, keeping its aspect ratio.
+  * Each pixel then is the average of the area it covers.
   */
-SDL_Surface *loadPNG(const std::string &path, bool loadAlpha = true);
+SDL_Surface *loadImageFile(const std::string &path, bool loadAlpha = true,
+		bool premultiply = false,
+		unsigned int maxWidth = 0, unsigned int maxHeight = 0);
+
+/** Loads an image from a PNG or QOI file into a newly allocated surface in the
+  * given pixel format, such as that of the display. Rows are converted as
+  * they are decoded, so no intermediate 32bpp copy of the image is made.
+  * The alpha channel is kept only if the format has one. If dither is true,
+  * formats with fewer than 8 bits per component, such as RGB565, are
+  * dithered with a 4x4 ordered dither matrix instead of truncated.
+  */
+SDL_Surface *loadImageFile(const std::string &path,
+		SDL_PixelFormat const& format, bool dither = false);
 
 #endif
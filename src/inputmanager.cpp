@@ -265,6 +265,7 @@ bool InputManager::getButton(Button *button, bool wait) {
 					break;
 #endif /* HAVE_LIBOPK */
 				case REPAINT_MENU:
+				case IMAGE_LOADED:
 				default:
 					break;
 			}
@@ -37,6 +37,8 @@ enum EventCode {
 	OPEN_PACKAGE,
 	OPEN_PACKAGES_FROM_DIR,
 	REPAINT_MENU,
+	/** An image that SurfaceCollection::request() queued is decoded. */
+	IMAGE_LOADED,
 };
 
 #ifndef SDL_JOYSTICK_DISABLED
@@ -0,0 +1,24 @@
+// Various authors.
+// License: GPL version 2 or later.
+
+#include "layer.h"
+
+#include "surface.h"
+
+
+SDL_Rect Layer::takeDamage()
+{
+	SDL_Rect rect = damage;
+	damage = { 0, 0, 0, 0 };
+	return rect;
+}
+
+void Layer::invalidate()
+{
+	damage = { 0, 0, 0xFFFF, 0xFFFF };
+}
+
+void Layer::invalidate(SDL_Rect const& rect)
+{
+	damage = rectUnion(damage, rect);
+}
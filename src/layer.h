@@ -6,6 +6,8 @@
 
 #include "inputmanager.h"
 
+#include <SDL.h>
+
 class Surface;
 class Touchscreen;
 
@@ -46,7 +48,35 @@ public:
 
 	Status getStatus() { return status; }
 
+	/**
+	 * Returns the area of the screen that has to be repainted because this
+	 * layer changed since it was last painted, and forgets about it.
+	 * An empty rectangle means nothing changed. A new layer has to be
+	 * painted completely.
+	 */
+	virtual SDL_Rect takeDamage();
+
+	/**
+	 * Returns true iff the painted image of this layer, composited over the
+	 * layers beneath it, should be retained in a backing surface. That
+	 * surface is only repainted where damage was reported, so while this
+	 * layer and the ones beneath it don't change, painting them costs a
+	 * single blit. This pays off for layers that are expensive to paint and
+	 * change less often than the layers on top of them.
+	 */
+	virtual bool isRetained() { return false; }
+
 protected:
+	/**
+	 * Marks the whole screen as needing a repaint.
+	 */
+	void invalidate();
+
+	/**
+	 * Marks the given area of the screen as needing a repaint.
+	 */
+	void invalidate(SDL_Rect const& rect);
+
 	/**
 	 * Request the Layer to be removed from the stack.
 	 * There could be a few more calls to the Layer before it is actually
@@ -58,6 +88,7 @@ protected:
 
 private:
 	Status status = Status::NORMAL;
+	SDL_Rect damage = { 0, 0, 0xFFFF, 0xFFFF };
 };
 
 #endif // LAYER_H
@@ -45,6 +45,8 @@ Link::Link(GMenu2X *gmenu2x, Action action)
 	iconPath = gmenu2x->sc.getSkinFilePath("icons/generic.png");
 	iconX = 0;
 	padding = 0;
+	selectionAsset = gmenu2x->sc.internSkinRes("imgs/selection.png", false);
+	placeholderAsset = gmenu2x->sc.internSkinRes("icons/generic.png");
 
 	updateSurfaces();
 }
@@ -66,27 +68,34 @@ bool Link::handleTS() {
 	return false;
 }
 
-void Link::paint() {
-	Surface& s = *gmenu2x->s;
-
-	if (iconSurface) {
-		iconSurface->blit(s, iconX, rect.y+padding, 32,32);
+void Link::paint(Surface& s) {
+	// Don't stall the frame on decoding an icon that is not loaded, for
+	// example one that was evicted or is in a newly inserted OPK.
+	if (auto icon = gmenu2x->sc.request(iconAsset, placeholderAsset)) {
+		icon->blit(s, iconX, rect.y+padding, 32,32);
 	}
 	gmenu2x->font->write(s, getTitle(), iconX+16, rect.y + gmenu2x->skinConfInt["linkHeight"]-padding, Font::HAlignCenter, Font::VAlignBottom);
 }
 
-void Link::paintHover() {
-	Surface& s = *gmenu2x->s;
-
-	if (gmenu2x->useSelectionPng)
-		gmenu2x->sc["imgs/selection.png"]->blit(s, rect, Font::HAlignCenter, Font::VAlignMiddle);
-	else
+void Link::paintHover(Surface& s) {
+	if (gmenu2x->useSelectionPng) {
+		if (auto selection = gmenu2x->sc.get(selectionAsset))
+			selection->blit(s, rect, Font::HAlignCenter, Font::VAlignMiddle);
+	} else {
 		s.box(rect.x, rect.y, rect.w, rect.h, gmenu2x->skinConfColors[COLOR_SELECTION_BG]);
+	}
 }
 
 void Link::updateSurfaces()
 {
-	iconSurface = gmenu2x->sc[getIconPath()];
+	// Icons are drawn at 32x32; larger ones are shrunk once, when loaded.
+	// The icon is loaded when it is first drawn, unless the menu preloads it.
+	iconAsset = gmenu2x->sc.intern(getIconPath(), 32);
+}
+
+shared_ptr<OffscreenSurface> Link::getIconSurface()
+{
+	return gmenu2x->sc.get(iconAsset);
 }
 
 const string &Link::getTitle() {
@@ -21,13 +21,17 @@
 #ifndef LINK_H
 #define LINK_H
 
+#include "surfacecollection.h"
+
 #include <SDL.h>
 
 #include <functional>
+#include <memory>
 #include <string>
 
 class GMenu2X;
 class OffscreenSurface;
+class Surface;
 class Touchscreen;
 
 
@@ -46,13 +50,14 @@ public:
 	bool isPressed();
 	bool handleTS();
 
-	virtual void paint();
-	void paintHover();
+	virtual void paint(Surface& s);
+	void paintHover(Surface& s);
 
 	virtual void loadIcon();
 
 	void setSize(int w, int h);
 	void setPosition(int x, int y);
+	SDL_Rect const& getRect() const { return rect; }
 
 	const std::string &getTitle();
 	void setTitle(const std::string &title);
@@ -62,6 +67,7 @@ public:
 	const std::string &getIcon();
 	void setIcon(const std::string &icon);
 	const std::string &getIconPath();
+	SurfaceCollection::AssetId getIconAsset() const { return iconAsset; }
 
 	void run();
 
@@ -70,7 +76,11 @@ protected:
 	bool edited;
 	std::string title, description, launchMsg, icon, iconPath;
 
-	OffscreenSurface *iconSurface;
+	/**
+	 * Returns the icon to draw, reloading it if the surface collection
+	 * evicted it.
+	 */
+	std::shared_ptr<OffscreenSurface> getIconSurface();
 
 	virtual const std::string &searchIcon();
 	void setIconPath(const std::string &icon);
@@ -79,6 +89,12 @@ protected:
 private:
 	void recalcCoordinates();
 
+	/**
+	 * Not owning references, so the surface collection can evict the
+	 * surfaces.
+	 */
+	SurfaceCollection::AssetId iconAsset, selectionAsset, placeholderAsset;
+
 	Touchscreen &ts;
 	Action action;
 
@@ -83,7 +83,7 @@ private:
 
 #ifdef HAVE_LIBOPK
 LinkApp::LinkApp(GMenu2X *gmenu2x_, string const& linkfile, bool deletable,
-			struct OPK *opk, const char *metadata_)
+			LinkIndex::Entry const* desktop)
 #else
 LinkApp::LinkApp(GMenu2X *gmenu2x_, string const& linkfile, bool deletable)
 #endif
@@ -106,15 +106,12 @@ LinkApp::LinkApp(GMenu2X *gmenu2x_, string const& linkfile, bool deletable)
 
 	bool appTakesFileArg = true;
 #ifdef HAVE_LIBOPK
-	isOPK = !!opk;
+	isOPK = !!desktop;
 
 	if (isOPK) {
 		string::size_type pos;
-		const char *key, *val;
-		size_t lkey, lval;
-		int ret;
 
-		metadata.assign(metadata_);
+		metadata = desktop->name;
 		opkFile = file;
 		pos = file.rfind('/');
 		opkMount = file.substr(pos+1);
@@ -122,55 +119,39 @@ LinkApp::LinkApp(GMenu2X *gmenu2x_, string const& linkfile, bool deletable)
 		opkMount = opkMount.substr(0, pos);
 
 		appTakesFileArg = false;
-		category = "applications";
+		category = categoryOf(*desktop);
 
-		while ((ret = opk_read_pair(opk, &key, &lkey, &val, &lval))) {
-			if (ret < 0) {
-				ERROR("Unable to read meta-data\n");
-				break;
-			}
-
-			char buf[lval + 1];
-			sprintf(buf, "%.*s", lval, val);
-
-			if (!strncmp(key, "Categories", lkey)) {
-				category = buf;
-
-				pos = category.find(';');
-				if (pos != category.npos)
-					category = category.substr(0, pos);
+		for (auto const& pair : desktop->values) {
+			string const& key = pair.first;
+			string const& buf = pair.second;
 
-			} else if ((!strncmp(key, "Name", lkey) && title.empty())
-						|| !strncmp(key, ("Name[" + gmenu2x->tr["Lng"] +
-								"]").c_str(), lkey)) {
+			if ((key == "Name" && title.empty())
+						|| key == "Name[" + gmenu2x->tr["Lng"] + "]") {
 				title = buf;
 
-			} else if ((!strncmp(key, "Comment", lkey) && description.empty())
-						|| !strncmp(key, ("Comment[" +
-								gmenu2x->tr["Lng"] + "]").c_str(), lkey)) {
+			} else if ((key == "Comment" && description.empty())
+						|| key == "Comment[" + gmenu2x->tr["Lng"] + "]") {
 				description = buf;
 
-			} else if (!strncmp(key, "Terminal", lkey)) {
-				consoleApp = !strncmp(val, "true", lval);
+			} else if (key == "Terminal") {
+				consoleApp = buf == "true";
 
-			} else if (!strncmp(key, "X-OD-Manual", lkey)) {
+			} else if (key == "X-OD-Manual") {
 				manual = buf;
 
-			} else if (!strncmp(key, "Icon", lkey)) {
+			} else if (key == "Icon") {
 				/* Read the icon from the OPK only
 				 * if it doesn't exist on the skin */
-				this->icon = gmenu2x->sc.getSkinFilePath("icons/" + (string) buf + ".png");
+				this->icon = gmenu2x->sc.getSkinFilePath("icons/" + buf + ".png");
 				if (this->icon.empty()) {
 					this->icon = linkfile + '#' + buf + ".png";
 				}
 				iconPath = this->icon;
 				updateSurfaces();
 
-			} else if (!strncmp(key, "Exec", lkey)) {
-				string tmp = buf;
-
+			} else if (key == "Exec") {
 				for (auto token : tokens) {
-					if (tmp.find(token) != tmp.npos) {
+					if (buf.find(token) != buf.npos) {
 						selectordir = CARD_ROOT;
 						appTakesFileArg = true;
 						break;
@@ -181,7 +162,7 @@ LinkApp::LinkApp(GMenu2X *gmenu2x_, string const& linkfile, bool deletable)
 			}
 
 #ifdef HAVE_LIBXDGMIME
-			if (!strncmp(key, "MimeType", lkey)) {
+			if (key == "MimeType") {
 				string mimetypes = buf;
 				selectorfilter = "";
 
@@ -217,16 +198,9 @@ LinkApp::LinkApp(GMenu2X *gmenu2x_, string const& linkfile, bool deletable)
 	}
 #endif /* HAVE_LIBOPK */
 
-	string line;
-	ifstream infile (file.c_str(), ios_base::in);
-	while (getline(infile, line, '\n')) {
-		line = trim(line);
-		if (line.empty()) continue;
-		if (line[0]=='#') continue;
-
-		string::size_type position = line.find("=");
-		string name = trim(line.substr(0,position));
-		string value = trim(line.substr(position+1));
+	for (auto const& pair : gmenu2x->linkIndex.readLinkFile(file)) {
+		string const& name = pair.first;
+		string const& value = pair.second;
 
 		if (name == "clock") {
 			setClock( atoi(value.c_str()) );
@@ -261,11 +235,22 @@ LinkApp::LinkApp(GMenu2X *gmenu2x_, string const& linkfile, bool deletable)
 		} else
 			WARNING("Unrecognized option: '%s'\n", name.c_str());
 	}
-	infile.close();
 
 	if (iconPath.empty()) searchIcon();
 }
 
+#ifdef HAVE_LIBOPK
+string LinkApp::categoryOf(LinkIndex::Entry const& desktop) {
+	string category = "applications";
+	for (auto const& pair : desktop.values) {
+		if (pair.first == "Categories") {
+			category = pair.second.substr(0, pair.second.find(';'));
+		}
+	}
+	return category;
+}
+#endif
+
 void LinkApp::loadIcon() {
 	if (icon.compare(0, 5, "skin:") == 0) {
 		string linkIcon = gmenu2x->sc.getSkinFilePath(
@@ -386,7 +371,9 @@ void LinkApp::drawLaunch(Surface& s) {
 		gmenu2x->sc[getIcon()]->blit(gmenu2x->s,x,104);
 	else
 		gmenu2x->sc["icons/generic.png"]->blit(gmenu2x->s,x,104);*/
-	iconSurface->blit(s, x, gmenu2x->halfY - 16);
+	if (auto icon = getIconSurface()) {
+		icon->blit(s, x, gmenu2x->halfY - 16);
+	}
 	gmenu2x->font->write(s, text, x + 42, gmenu2x->halfY + 1, Font::HAlignLeft, Font::VAlignMiddle);
 }
 
@@ -452,11 +439,11 @@ void LinkApp::showManual() {
 		if (!pngman) {
 			return;
 		}
-		auto bg = OffscreenSurface::loadImage(gmenu2x->confStr["wallpaper"]);
+		auto bg = gmenu2x->sc.loadDisplayFormat(gmenu2x->confStr["wallpaper"]);
 		if (!bg) {
 			bg = OffscreenSurface::emptySurface(gmenu2x->s->width(), gmenu2x->s->height());
+			bg->convertToDisplayFormat();
 		}
-		bg->convertToDisplayFormat();
 
 		stringstream ss;
 		string pageStatus;
@@ -22,6 +22,7 @@
 #define LINKAPP_H
 
 #include "link.h"
+#include "linkindex.h"
 
 #include <memory>
 #include <string>
@@ -61,8 +62,15 @@ public:
 	bool isOpk() { return isOPK; }
 	const std::string &getOpkFile() { return opkFile; }
 
+	/**
+	 * Creates a link from a link file or, when "desktop" is given, from
+	 * that desktop entry of the OPK package at "linkfile".
+	 */
 	LinkApp(GMenu2X *gmenu2x, std::string const& linkfile, bool deletable,
-				struct OPK *opk = NULL, const char *metadata = NULL);
+				LinkIndex::Entry const* desktop = nullptr);
+
+	/** Returns the section of the link for the given desktop entry. */
+	static std::string categoryOf(LinkIndex::Entry const& desktop);
 #else
 	LinkApp(GMenu2X *gmenu2x, std::string const& linkfile, bool deletable);
 	bool isOpk() { return false; }
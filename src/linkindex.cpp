@@ -0,0 +1,265 @@
+// Various authors.
+// License: GPL version 2 or later.
+
+#include "linkindex.h"
+
+#include "debug.h"
+#include "utilities.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+/**
+ * Start of the index file. It is followed by "count" files, each being its
+ * path, its modification time (int64_t), its size (uint64_t) and the number
+ * of its entries (uint32_t), followed by the entries. An entry is its name
+ * and the number of its values, followed by a name and a value per value.
+ * Strings are stored as their length (uint32_t) followed by their bytes.
+ */
+struct Header {
+	char magic[4];
+	uint32_t version;
+	uint32_t count;
+};
+
+/** Reads from the index file; any read past its end fails. */
+class Reader {
+public:
+	Reader(const char *data, size_t size) : p(data), end(data + size) {}
+
+	template<typename T> bool read(T &value) {
+		if ((size_t) (end - p) < sizeof(T)) return false;
+		memcpy(&value, p, sizeof(T));
+		p += sizeof(T);
+		return true;
+	}
+
+	bool read(string &str) {
+		uint32_t length;
+		if (!read(length) || (size_t) (end - p) < length) return false;
+		str.assign(p, length);
+		p += length;
+		return true;
+	}
+
+private:
+	const char *p, *const end;
+};
+
+class Writer {
+public:
+	template<typename T> void write(T const& value) {
+		out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+	}
+
+	void write(string const& str) {
+		write<uint32_t>(str.size());
+		out.append(str);
+	}
+
+	string out;
+};
+
+}
+
+static const char MAGIC[4] = { 'G', 'M', 'L', 'I' };
+static const uint32_t VERSION = 1;
+
+LinkIndex::LinkIndex(string const& file)
+	: file(file)
+	, loaded(false)
+	, dirty(false)
+{
+}
+
+void LinkIndex::load() {
+	loaded = true;
+
+	FILE *fp = fopen(file.c_str(), "rb");
+	if (!fp) {
+		return;
+	}
+	string data;
+	char buf[16384];
+	size_t length;
+	while ((length = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		data.append(buf, length);
+	}
+	fclose(fp);
+
+	Reader reader(data.data(), data.size());
+	Header header;
+	if (!reader.read(header) || memcmp(header.magic, MAGIC, sizeof(MAGIC))
+			|| header.version != VERSION) {
+		WARNING("Ignoring invalid or outdated link index '%s'\n", file.c_str());
+		return;
+	}
+	for (uint32_t i = 0; i < header.count; i++) {
+		string path;
+		File indexed;
+		uint32_t numEntries;
+		if (!reader.read(path) || !reader.read(indexed.time)
+				|| !reader.read(indexed.size) || !reader.read(numEntries)) {
+			break;
+		}
+		bool ok = true;
+		for (uint32_t j = 0; ok && j < numEntries; j++) {
+			Entry entry;
+			uint32_t numValues;
+			ok = reader.read(entry.name) && reader.read(numValues);
+			for (uint32_t k = 0; ok && k < numValues; k++) {
+				string name, value;
+				ok = reader.read(name) && reader.read(value);
+				entry.values.emplace_back(move(name), move(value));
+			}
+			indexed.entries.push_back(move(entry));
+		}
+		if (!ok) {
+			break;
+		}
+		indexed.used = false;
+		files[path] = move(indexed);
+	}
+	DEBUG("Loaded %zu files from the link index\n", files.size());
+}
+
+vector<LinkIndex::Entry> const* LinkIndex::find(string const& path,
+		struct stat const& st)
+{
+	if (!loaded) {
+		load();
+	}
+	auto it = files.find(path);
+	if (it == files.end() || it->second.time != st.st_mtime
+			|| it->second.size != (uint64_t) st.st_size) {
+		return nullptr;
+	}
+	it->second.used = true;
+	return &it->second.entries;
+}
+
+void LinkIndex::keep(string const& path) {
+	if (!loaded) {
+		load();
+	}
+	auto it = files.find(path);
+	if (it != files.end()) {
+		it->second.used = true;
+	}
+}
+
+void LinkIndex::store(string const& path, struct stat const& st,
+		vector<Entry> entries)
+{
+	if (!loaded) {
+		load();
+	}
+	File &indexed = files[path];
+	indexed.time = st.st_mtime;
+	indexed.size = st.st_size;
+	indexed.entries = move(entries);
+	indexed.used = true;
+	dirty = true;
+}
+
+LinkIndex::Values LinkIndex::readLinkFile(string const& path) {
+	struct stat st;
+	if (stat(path.c_str(), &st) < 0) {
+		return Values();
+	}
+	if (auto entries = find(path, st)) {
+		return entries->empty() ? Values() : entries->front().values;
+	}
+
+	Entry entry;
+	string line;
+	ifstream infile (path.c_str(), ios_base::in);
+	while (getline(infile, line, '\n')) {
+		line = trim(line);
+		if (line.empty()) continue;
+		if (line[0]=='#') continue;
+
+		string::size_type position = line.find("=");
+		entry.values.emplace_back(trim(line.substr(0,position)),
+				trim(line.substr(position+1)));
+	}
+	infile.close();
+
+	vector<Entry> entries;
+	entries.push_back(entry);
+	store(path, st, move(entries));
+	return entry.values;
+}
+
+void LinkIndex::save() {
+	if (!loaded) {
+		return;
+	}
+
+	for (auto it = files.begin(); it != files.end(); ) {
+		if (it->second.used) {
+			++it;
+		} else {
+			// Most likely removed; keeping it would let the index grow forever.
+			it = files.erase(it);
+			dirty = true;
+		}
+	}
+	if (!dirty) {
+		return;
+	}
+
+	Writer writer;
+	Header header;
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.count = files.size();
+	writer.write(header);
+	for (auto const& it : files) {
+		File const& indexed = it.second;
+		writer.write(it.first);
+		writer.write(indexed.time);
+		writer.write(indexed.size);
+		writer.write<uint32_t>(indexed.entries.size());
+		for (Entry const& entry : indexed.entries) {
+			writer.write(entry.name);
+			writer.write<uint32_t>(entry.values.size());
+			for (auto const& value : entry.values) {
+				writer.write(value.first);
+				writer.write(value.second);
+			}
+		}
+	}
+
+	const string dir = file.substr(0, file.rfind('/'));
+	if (mkdir(dir.c_str(), 0770) < 0 && errno != EEXIST) {
+		WARNING("Unable to create directory '%s'\n", dir.c_str());
+		return;
+	}
+	// Write to a temporary file first, so an interrupted write does not
+	// leave a truncated index behind.
+	const string tmp = file + ".tmp";
+	FILE *fp = fopen(tmp.c_str(), "wb");
+	if (!fp) {
+		WARNING("Unable to write link index '%s'\n", tmp.c_str());
+		return;
+	}
+	bool ok = fwrite(writer.out.data(), 1, writer.out.size(), fp)
+			== writer.out.size();
+	ok = fclose(fp) == 0 && ok;
+	if (!ok || rename(tmp.c_str(), file.c_str()) < 0) {
+		WARNING("Unable to write link index '%s'\n", file.c_str());
+		unlink(tmp.c_str());
+		return;
+	}
+	dirty = false;
+	DEBUG("Saved %u files to the link index\n", header.count);
+}
@@ -0,0 +1,87 @@
+// Various authors.
+// License: GPL version 2 or later.
+
+#ifndef LINKINDEX_H
+#define LINKINDEX_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct stat;
+
+/**
+ * Persistent index of the values read from link files and from the desktop
+ * entries of OPK packages, so that a start of the menu does not have to
+ * parse every link file and open every package again.
+ *
+ * The index holds the raw name and value pairs rather than what LinkApp
+ * derives from them: values that depend on the language or the skin are
+ * still resolved on every start. An indexed file is valid as long as its
+ * size and modification time are those it was indexed with; checking that
+ * takes a single stat().
+ */
+class LinkIndex {
+public:
+	typedef std::vector<std::pair<std::string, std::string>> Values;
+
+	/**
+	 * The values of a link file, or of one desktop entry of a package
+	 * together with the name of its metadata file.
+	 */
+	struct Entry {
+		std::string name;
+		Values values;
+	};
+
+	LinkIndex(std::string const& file);
+
+	/**
+	 * Returns the name and value pairs of the given link file, in the
+	 * order they appear in the file. Comments and blank lines are skipped.
+	 * Returns no values if the file does not exist.
+	 */
+	Values readLinkFile(std::string const& path);
+
+	/**
+	 * Returns the entries indexed for the file at the given path, or
+	 * nullptr if there are none or the file changed since it was indexed.
+	 * @param st The current status of the file.
+	 */
+	std::vector<Entry> const* find(std::string const& path,
+			struct stat const& st);
+
+	/**
+	 * Keeps the entry of a file that still exists but was not looked up,
+	 * when the index is saved.
+	 */
+	void keep(std::string const& path);
+
+	/** Indexes the entries read from the file at the given path. */
+	void store(std::string const& path, struct stat const& st,
+			std::vector<Entry> entries);
+
+	/**
+	 * Writes the index file if it changed. Files that were not looked up,
+	 * kept or stored since the index was loaded are left out.
+	 */
+	void save();
+
+private:
+	struct File {
+		int64_t time;
+		uint64_t size;
+		std::vector<Entry> entries;
+		bool used;
+	};
+
+	void load();
+
+	const std::string file;
+	std::unordered_map<std::string, File> files;
+	bool loaded, dirty;
+};
+
+#endif
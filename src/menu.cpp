@@ -28,6 +28,9 @@
 #include <unistd.h>
 #include <ini.h>
 #include <cassert>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
 
 #ifdef HAVE_LIBOPK
 #include <opk.h>
@@ -39,6 +42,7 @@
 #include "monitor.h"
 #include "filelister.h"
 #include "utilities.h"
+#include "workerpool.h"
 #include "debug.h"
 
 using namespace std;
@@ -72,6 +76,10 @@ Menu::Menu(GMenu2X *gmenu2x, Touchscreen &ts)
 	, ts(ts)
 	, btnContextMenu(gmenu2x, ts, "skin:imgs/menu.png", "",
 			std::bind(&GMenu2X::showContextMenu, gmenu2x))
+	, sectionLeftAsset(gmenu2x->sc.internSkinRes("imgs/section-l.png"))
+	, sectionRightAsset(gmenu2x->sc.internSkinRes("imgs/section-r.png"))
+	, manualAsset(gmenu2x->sc.internSkinRes("imgs/manual.png"))
+	, selectionAsset(gmenu2x->sc.internSkinRes("imgs/selection.png", false))
 {
 	readSections(GMENU2X_SYSTEM_DIR "/sections");
 	readSections(GMenu2X::getHome() + "/sections");
@@ -82,6 +90,7 @@ Menu::Menu(GMenu2X *gmenu2x, Touchscreen &ts)
 
 #ifdef HAVE_LIBOPK
 	{
+		vector<string> dirs;
 		struct dirent *dptr;
 		DIR *dirp = opendir(CARD_ROOT);
 		if (dirp) {
@@ -92,14 +101,22 @@ Menu::Menu(GMenu2X *gmenu2x, Touchscreen &ts)
 				if (!strcmp(dptr->d_name, ".") || !strcmp(dptr->d_name, ".."))
 					continue;
 
-				openPackagesFromDir((string) CARD_ROOT + "/" +
+				dirs.push_back((string) CARD_ROOT + "/" +
 							dptr->d_name + "/apps");
 			}
 			closedir(dirp);
 		}
+		sort(dirs.begin(), dirs.end());
+		openPackagesFromDirs(dirs);
 	}
 #endif
 
+	// Only the links of the shown section are created now.
+	materialize(iSection);
+
+	// Remember what was parsed, for the next start.
+	gmenu2x->linkIndex.save();
+
 	btnContextMenu.setPosition(gmenu2x->resX - 38, gmenu2x->bottomBarIconY);
 }
 
@@ -123,6 +140,7 @@ void Menu::readSections(std::string parentDir)
 			sections.emplace_back(dptr->d_name);
 			vector<Link*> ll;
 			links.push_back(ll);
+			linkRecords.emplace_back();
 		}
 	}
 
@@ -137,16 +155,87 @@ void Menu::skinUpdated() {
 	linkRows = (gmenu2x->resY - 35 - skinConfInt["topBarHeight"]) / skinConfInt["linkHeight"];
 
 	//reload section icons
+	sectionStrip.reset();
+	SurfaceCollection &sc = gmenu2x->sc;
+	vector<SurfaceCollection::AssetId> icons = {
+		sectionLeftAsset, sectionRightAsset, manualAsset, selectionAsset,
+		sc.internSkinRes("icons/section.png"),
+	};
 	vector<string>::size_type i = 0;
 	for (string sectionName : sections) {
-		gmenu2x->sc["skin:sections/" + sectionName + ".png"];
+		icons.push_back(sc.intern("skin:sections/" + sectionName + ".png"));
 
+		// Links that are not created yet will use the new skin anyway.
 		for (Link *&link : links[i]) {
 			link->loadIcon();
+			if ((int) i == iSection) {
+				icons.push_back(link->getIconAsset());
+			}
 		}
 
 		i++;
 	}
+	sc.preload(icons);
+
+	invalidate();
+}
+
+/* Keeps the coordinates in the strip within the 16-bit range of SDL_Rect and
+ * its pitch within the 16-bit range of SDL_Surface, even at 32bpp. */
+static const int MAX_SECTION_STRIP_WIDTH = 8192;
+
+void Menu::renderSectionStrip() {
+	Font &font = *gmenu2x->font;
+	SurfaceCollection &sc = gmenu2x->sc;
+	const int topBarHeight = gmenu2x->skinConfInt["topBarHeight"];
+
+	// Long section names are wider than a link; leave room for the outline.
+	sectionCellWidth = gmenu2x->skinConfInt["linkWidth"];
+	for (string const& section : sections) {
+		sectionCellWidth = max(sectionCellWidth, font.getTextWidth(section) + 8);
+	}
+	sectionCellWidth = min(max(sectionCellWidth, 1), MAX_SECTION_STRIP_WIDTH);
+
+	// Wrap the cells to more rows if they would not fit in a single one.
+	const int numCells = max<int>(sections.size(), 1);
+	sectionStripColumns = min(numCells, MAX_SECTION_STRIP_WIDTH / sectionCellWidth);
+	const int rows = (numCells + sectionStripColumns - 1) / sectionStripColumns;
+	if (rows * topBarHeight > numeric_limits<Sint16>::max()) {
+		ERROR("Too many sections to draw their headers\n");
+		return;
+	}
+
+	sectionStrip = OffscreenSurface::transparentSurface(
+			sectionStripColumns * sectionCellWidth, rows * topBarHeight);
+	if (!sectionStrip) {
+		return;
+	}
+
+	const uint sectionLinkPadding = (topBarHeight - 32 - font.getLineSpacing()) / 3;
+	for (uint i = 0; i < sections.size(); i++) {
+		auto icon = sc["skin:sections/" + sections[i] + ".png"];
+		if (!icon) {
+			icon = sc.skinRes("icons/section.png");
+		}
+		const SDL_Rect cell = sectionCell(i);
+		const int x = cell.x + sectionCellWidth / 2;
+		if (icon) {
+			icon->blit(*sectionStrip, x - 16, cell.y + sectionLinkPadding, 32, 32);
+		}
+		font.write(*sectionStrip, sections[i],
+				x, cell.y + topBarHeight - sectionLinkPadding,
+				Font::HAlignCenter, Font::VAlignBottom);
+	}
+}
+
+SDL_Rect Menu::sectionCell(uint section) {
+	const int topBarHeight = gmenu2x->skinConfInt["topBarHeight"];
+	return {
+		static_cast<Sint16>(section % sectionStripColumns * sectionCellWidth),
+		static_cast<Sint16>(section / sectionStripColumns * topBarHeight),
+		static_cast<Uint16>(sectionCellWidth),
+		static_cast<Uint16>(topBarHeight)
+	};
 }
 
 void Menu::calcSectionRange(int &leftSection, int &rightSection) {
@@ -196,14 +285,12 @@ void Menu::paint(Surface &s) {
 
 	// Paint section headers.
 	s.box(width / 2  - linkWidth / 2, 0, linkWidth, topBarHeight, selectionBgColor);
-	const uint sectionLinkPadding = (topBarHeight - 32 - font.getLineSpacing()) / 3;
+	if (!sectionStrip) {
+		renderSectionStrip();
+	}
 	const uint numSections = sections.size();
-	for (int i = leftSection; i <= rightSection; i++) {
+	for (int i = leftSection; sectionStrip && i <= rightSection; i++) {
 		uint j = (centerSection + numSections + i) % numSections;
-		string sectionIcon = "skin:sections/" + sections[j] + ".png";
-		Surface *icon = sc.exists(sectionIcon)
-				? sc[sectionIcon]
-				: sc.skinRes("icons/section.png");
 		int x = width / 2 + i * linkWidth + sectionDelta;
 		if (i == leftSection) {
 			int t = sectionDelta > 0 ? linkWidth - sectionDelta : -sectionDelta;
@@ -212,16 +299,14 @@ void Menu::paint(Surface &s) {
 			int t = sectionDelta < 0 ? sectionDelta + linkWidth : sectionDelta;
 			x += (((t * t) / linkWidth) * t) / linkWidth;
 		}
-		icon->blit(s, x - 16, sectionLinkPadding, 32, 32);
-		font.write(s, sections[j], x, topBarHeight - sectionLinkPadding,
-				Font::HAlignCenter, Font::VAlignBottom);
+		sectionStrip->blitPart(s, sectionCell(j), x - sectionCellWidth / 2, 0);
 	}
-	sc.skinRes("imgs/section-l.png")->blit(s, 0, 0);
-	sc.skinRes("imgs/section-r.png")->blit(s, width - 10, 0);
+	sc.get(sectionLeftAsset)->blit(s, 0, 0);
+	sc.get(sectionRightAsset)->blit(s, width - 10, 0);
 
 	vector<Link*> &sectionLinks = links[iSection];
 	const uint numLinks = sectionLinks.size();
-	gmenu2x->drawScrollBar(
+	gmenu2x->drawScrollBar(s,
 			linkRows, (numLinks + linkColumns - 1) / linkColumns, iFirstDispRow);
 
 	//Links
@@ -238,10 +323,10 @@ void Menu::paint(Surface &s) {
 		sectionLinks.at(i)->setPosition(x, y);
 
 		if (i == (uint)iLink) {
-			sectionLinks.at(i)->paintHover();
+			sectionLinks.at(i)->paintHover(s);
 		}
 
-		sectionLinks.at(i)->paint();
+		sectionLinks.at(i)->paint(s);
 	}
 
 	if (selLink()) {
@@ -259,13 +344,76 @@ void Menu::paint(Surface &s) {
 #endif
 		//Manual indicator
 		if (!linkApp->getManual().empty())
-			sc.skinRes("imgs/manual.png")->blit(
+			sc.get(manualAsset)->blit(
 					s, gmenu2x->manualX, gmenu2x->bottomBarIconY);
 	}
 
 	if (ts.available()) {
 		btnContextMenu.paint(s);
 	}
+
+	paintedSection = iSection;
+	paintedLink = iLink;
+	paintedFirstRow = iFirstDispRow;
+	paintedSectionOffset = sectionFP;
+}
+
+SDL_Rect Menu::takeDamage() {
+	if (gmenu2x->sc.storeLoaded()) {
+		// Replace placeholders by the icons that were loaded.
+		invalidate();
+	} else if (sectionAnimation.currentValue() != paintedSectionOffset
+			|| iSection != paintedSection || iFirstDispRow != paintedFirstRow) {
+		// Comparing with the painted value rather than checking whether the
+		// animation runs also repaints the frame in which it came to rest.
+		invalidate();
+	} else if (iLink != paintedLink) {
+		// Only the selection moved: repaint the old and new selected link
+		// and the details of the selected link in the bottom bar.
+		invalidateLink(paintedLink);
+		invalidateLink(iLink);
+
+		const int detailsY = gmenu2x->resY
+				- gmenu2x->skinConfInt["bottomBarHeight"] + 2
+				- gmenu2x->font->getLineSpacing() - 4;
+		invalidate((SDL_Rect) {
+			0, static_cast<Sint16>(detailsY),
+			static_cast<Uint16>(gmenu2x->resX),
+			static_cast<Uint16>(gmenu2x->resY - detailsY)
+		});
+	}
+	paintedLink = iLink;
+	return Layer::takeDamage();
+}
+
+bool Menu::isRetained() {
+	// While the sections scroll, the menu changes every frame.
+	return !sectionAnimation.isRunning();
+}
+
+void Menu::invalidateLink(int i) {
+	vector<Link*> &sectionLinks = links[iSection];
+	if (i < 0 || i >= (int)sectionLinks.size()) {
+		invalidate();
+		return;
+	}
+
+	// Leave some room for the outline of the title.
+	SDL_Rect const& rect = sectionLinks[i]->getRect();
+	int w = rect.w + 8, h = rect.h + 8;
+	if (gmenu2x->useSelectionPng) {
+		// The selection image is centered on the link and can be larger.
+		auto selection = gmenu2x->sc.get(selectionAsset);
+		if (selection) {
+			w = max(w, selection->width() + 2);
+			h = max(h, selection->height() + 2);
+		}
+	}
+	invalidate((SDL_Rect) {
+		static_cast<Sint16>(rect.x + (rect.w - w) / 2),
+		static_cast<Sint16>(rect.y + (rect.h - h) / 2),
+		static_cast<Uint16>(w), static_cast<Uint16>(h)
+	});
 }
 
 bool Menu::handleButtonPress(InputManager::Button button) {
@@ -352,17 +500,20 @@ vector<Link*> *Menu::sectionLinks(int i) {
 	if (i<0 || i>(int)links.size())
 		return NULL;
 
+	materialize(i);
 	return &links[i];
 }
 
 void Menu::decSectionIndex() {
 	sectionAnimation.adjust(-1 << 16);
 	setSectionIndex(iSection - 1);
+	prefetchSection(iSection - 1);
 }
 
 void Menu::incSectionIndex() {
 	sectionAnimation.adjust(1 << 16);
 	setSectionIndex(iSection + 1);
+	prefetchSection(iSection + 1);
 }
 
 int Menu::selSectionIndex() {
@@ -382,6 +533,7 @@ void Menu::setSectionIndex(int i) {
 
 	iLink = 0;
 	iFirstDispRow = 0;
+	materialize(iSection);
 }
 
 /*====================================
@@ -402,6 +554,7 @@ void Menu::addActionLink(uint section, const string &title, Action action, const
 	}
 
 	links[section].push_back(link);
+	invalidate();
 }
 
 bool Menu::addLink(string path, string file, string section) {
@@ -475,11 +628,7 @@ bool Menu::addLink(string path, string file, string section) {
 	if (fileExists(exename+".png")) icon = exename+".png";
 
 	//Reduce title lenght to fit the link width
-	if (gmenu2x->font->getTextWidth(shorttitle)>gmenu2x->skinConfInt["linkWidth"]) {
-		while (gmenu2x->font->getTextWidth(shorttitle+"..")>gmenu2x->skinConfInt["linkWidth"])
-			shorttitle = shorttitle.substr(0,shorttitle.length()-1);
-		shorttitle += "..";
-	}
+	shorttitle = gmenu2x->font->ellipsize(shorttitle, gmenu2x->skinConfInt["linkWidth"]);
 
 	ofstream f(linkpath.c_str());
 	if (f.is_open()) {
@@ -498,6 +647,7 @@ bool Menu::addLink(string path, string file, string section) {
 			LinkApp* link = new LinkApp(gmenu2x, linkpath, true);
 			link->setSize(gmenu2x->skinConfInt["linkWidth"],gmenu2x->skinConfInt["linkHeight"]);
 			links[isection].push_back( link );
+			invalidate();
 		}
 	} else {
 
@@ -519,6 +669,9 @@ bool Menu::addSection(const string &sectionName) {
 		sections.push_back(sectionName);
 		vector<Link*> ll;
 		links.push_back(ll);
+		linkRecords.emplace_back();
+		sectionStrip.reset();
+		invalidate();
 		return true;
 	}
 	return false;
@@ -544,6 +697,8 @@ void Menu::deleteSelectedLink()
 
 	if (!icon_used)
 	  gmenu2x->sc.del(iconpath);
+
+	invalidate();
 }
 
 void Menu::deleteSelectedSection() {
@@ -551,8 +706,11 @@ void Menu::deleteSelectedSection() {
 
 	gmenu2x->sc.del("sections/"+selSection()+".png");
 	links.erase( links.begin()+selSectionIndex() );
+	linkRecords.erase( linkRecords.begin()+selSectionIndex() );
 	sections.erase( sections.begin()+selSectionIndex() );
 	setSectionIndex(0); //reload sections
+	sectionStrip.reset();
+	invalidate();
 }
 
 bool Menu::linkChangeSection(uint linkIndex, uint oldSectionIndex, uint newSectionIndex) {
@@ -562,6 +720,7 @@ bool Menu::linkChangeSection(uint linkIndex, uint oldSectionIndex, uint newSecti
 		//Select the same link in the new position
 		setSectionIndex(newSectionIndex);
 		setLinkIndex(sectionLinks(newSectionIndex)->size()-1);
+		invalidate();
 		return true;
 	}
 	return false;
@@ -643,86 +802,176 @@ void Menu::setLinkIndex(int i) {
 #ifdef HAVE_LIBOPK
 void Menu::openPackagesFromDir(std::string path)
 {
-	DEBUG("Opening packages from directory: %s\n", path.c_str());
-	readPackages(path);
+	openPackagesFromDirs(vector<string>(1, path));
+}
+
+void Menu::openPackagesFromDirs(vector<string> const& dirs)
+{
+	readPackages(dirs);
 #ifdef ENABLE_INOTIFY
-	monitors.emplace_back(new Monitor(path.c_str()));
+	for (auto const& dir : dirs) {
+		monitors.emplace_back(new Monitor(dir.c_str()));
+	}
 #endif
 }
 
-void Menu::openPackage(std::string path, bool order)
+/* Reads the desktop entries of a package that apply to this platform.
+ * Returns false if the package could not be read completely. */
+static bool readDesktopEntries(std::string const& path,
+		vector<LinkIndex::Entry> &entries)
 {
-	/* First try to remove existing links of the same OPK
-	 * (needed for instance when an OPK is modified) */
-	removePackageLink(path);
-
 	struct OPK *opk = opk_open(path.c_str());
 	if (!opk) {
 		ERROR("Unable to open OPK %s\n", path.c_str());
-		return;
+		return false;
 	}
 
+	bool ok = true;
 	for (;;) {
-		unsigned int i;
-		bool has_metadata = false;
+		string::size_type pos;
 		const char *name;
-		LinkApp *link;
+		int ret = opk_open_metadata(opk, &name);
+		if (ret < 0) {
+			ERROR("Error while loading meta-data\n");
+			ok = false;
+			break;
+		} else if (!ret)
+		  break;
 
-		for (;;) {
-			string::size_type pos;
-			int ret = opk_open_metadata(opk, &name);
-			if (ret < 0) {
-				ERROR("Error while loading meta-data\n");
-				break;
-			} else if (!ret)
-			  break;
+		/* Strip .desktop */
+		string metadata(name);
+		pos = metadata.rfind('.');
+		metadata = metadata.substr(0, pos);
 
-			/* Strip .desktop */
-			string metadata(name);
-			pos = metadata.rfind('.');
-			metadata = metadata.substr(0, pos);
+		/* Keep only the platform name */
+		pos = metadata.rfind('.');
+		metadata = metadata.substr(pos + 1);
 
-			/* Keep only the platform name */
-			pos = metadata.rfind('.');
-			metadata = metadata.substr(pos + 1);
+		if (metadata != PLATFORM && metadata != "all")
+			continue;
 
-			if (metadata == PLATFORM || metadata == "all") {
-				has_metadata = true;
+		LinkIndex::Entry entry;
+		entry.name = name;
+		const char *key, *val;
+		size_t lkey, lval;
+		while ((ret = opk_read_pair(opk, &key, &lkey, &val, &lval))) {
+			if (ret < 0) {
+				ERROR("Unable to read meta-data\n");
+				ok = false;
 				break;
 			}
+			entry.values.emplace_back(string(key, lkey), string(val, lval));
 		}
+		entries.push_back(entry);
+	}
 
-		if (!has_metadata)
-		  break;
+	opk_close(opk);
+	return ok;
+}
 
-		// Note: OPK links can only be deleted by removing the OPK itself,
-		//       but that is not something we want to do in the menu,
-		//       so consider this link undeletable.
-		link = new LinkApp(gmenu2x, path, false, opk, name);
-		link->setSize(gmenu2x->skinConfInt["linkWidth"], gmenu2x->skinConfInt["linkHeight"]);
+void Menu::addPackageLinks(std::string const& path,
+		vector<LinkIndex::Entry> const& entries)
+{
+	for (auto const& entry : entries) {
+		unsigned int i;
+		const string category = LinkApp::categoryOf(entry);
 
-		addSection(link->getCategory());
+		addSection(category);
 		for (i = 0; i < sections.size(); i++) {
-			if (sections[i] == link->getCategory()) {
-				links[i].push_back(link);
+			if (sections[i] == category) {
+				// Note: OPK links can only be deleted by removing the OPK itself,
+				//       but that is not something we want to do in the menu,
+				//       so consider this link undeletable.
+				LinkRecord record;
+				record.file = path;
+				record.deletable = false;
+				record.desktop.reset(new LinkIndex::Entry(entry));
+				linkRecords[i].push_back(move(record));
 				break;
 			}
 		}
 	}
+}
+
+void Menu::openPackage(std::string path, bool order)
+{
+	/* First try to remove existing links of the same OPK
+	 * (needed for instance when an OPK is modified) */
+	removePackageLink(path);
+
+	struct stat st;
+	if (stat(path.c_str(), &st) < 0) {
+		ERROR("Unable to open OPK %s\n", path.c_str());
+		return;
+	}
 
-	opk_close(opk);
+	/* Only open the package if it changed since it was indexed */
+	vector<LinkIndex::Entry> read;
+	auto entries = gmenu2x->linkIndex.find(path, st);
+	if (!entries) {
+		if (readDesktopEntries(path, read))
+			gmenu2x->linkIndex.store(path, st, read);
+		entries = &read;
+	}
 
-	if (order)
+	addPackageLinks(path, *entries);
+	materialize(iSection);
+	invalidate();
+
+	if (order) {
 		orderLinks();
+		gmenu2x->linkIndex.save();
+	}
 }
 
-void Menu::readPackages(std::string parentDir)
+namespace {
+
+/** A package found while scanning a directory. */
+struct Package {
+	std::string path;
+	struct stat st;
+	vector<LinkIndex::Entry> entries;
+	bool indexed, complete;
+};
+
+/** Waits for a number of tasks submitted to a worker pool. */
+class TaskCounter {
+public:
+	TaskCounter(size_t count) : count(count) {}
+
+	// Notify while holding the lock: the waiter's frame, which holds this
+	// counter, may be gone as soon as the count reaches zero.
+	void done() {
+		std::lock_guard<std::mutex> lock(countMutex);
+		if (--count == 0) zero.notify_one();
+	}
+
+	void wait() {
+		std::unique_lock<std::mutex> lock(countMutex);
+		zero.wait(lock, [this] { return count == 0; });
+	}
+
+private:
+	std::mutex countMutex;
+	std::condition_variable zero;
+	size_t count;
+};
+
+}
+
+/* Package reading mostly waits for the card, so use more than one thread
+ * even on a single core. */
+static const unsigned int PACKAGE_THREADS = 4;
+
+/* Lists the packages in the given directory, sorted by name. */
+static void findPackages(std::string const& dir, vector<Package> &packages)
 {
 	DIR *dirp;
 	struct dirent *dptr;
-	vector<string> linkfiles;
+	vector<string> names;
 
-	dirp = opendir(parentDir.c_str());
+	DEBUG("Opening packages from directory: %s\n", dir.c_str());
+	dirp = opendir(dir.c_str());
 	if (!dirp)
 		return;
 
@@ -745,11 +994,90 @@ void Menu::readPackages(std::string parentDir)
 			continue;
 		}
 
-		openPackage(parentDir + '/' + dptr->d_name, false);
+		names.push_back(dptr->d_name);
 	}
 
 	closedir(dirp);
+	sort(names.begin(), names.end());
+
+	for (auto const& name : names) {
+		Package package = Package();
+		package.path = dir + '/' + name;
+		if (stat(package.path.c_str(), &package.st) == 0)
+			packages.push_back(move(package));
+	}
+}
+
+void Menu::readPackages(vector<string> const& dirs)
+{
+	// The directories are usually on different cards, which can be read
+	// at the same time; so are the packages on a card.
+	WorkerPool workers(PACKAGE_THREADS);
+
+	vector<vector<Package>> found(dirs.size());
+	{
+		TaskCounter listed(dirs.size());
+		for (size_t i = 0; i < dirs.size(); i++) {
+			workers.submit([&dirs, &found, &listed, i] {
+				findPackages(dirs[i], found[i]);
+				listed.done();
+			});
+		}
+		listed.wait();
+	}
+
+	// Only packages that changed since they were indexed are opened.
+	// Take turns between the directories, so that no card sits idle while
+	// the packages of another are read.
+	vector<Package *> toRead;
+	bool more = true;
+	for (size_t n = 0; more; n++) {
+		more = false;
+		for (auto& packages : found) {
+			if (n >= packages.size())
+				continue;
+			more = true;
+			Package &package = packages[n];
+			auto entries = gmenu2x->linkIndex.find(package.path, package.st);
+			if (entries) {
+				package.entries = *entries;
+				package.indexed = true;
+			} else {
+				toRead.push_back(&package);
+			}
+		}
+	}
+	if (!toRead.empty()) {
+		DEBUG("Reading %zu packages on %u threads\n",
+				toRead.size(), workers.threadCount());
+		TaskCounter read(toRead.size());
+		for (Package *package : toRead) {
+			workers.submit([package, &read] {
+				package->complete =
+						readDesktopEntries(package->path, package->entries);
+				read.done();
+			});
+		}
+		read.wait();
+	}
+
+	// Add the links in a fixed order, whichever package was read first.
+	for (auto& packages : found) {
+		for (Package &package : packages) {
+#ifdef ENABLE_INOTIFY
+			removePackageLink(package.path);
+#endif
+			addPackageLinks(package.path, package.entries);
+			if (!package.indexed && package.complete) {
+				gmenu2x->linkIndex.store(package.path, package.st,
+						move(package.entries));
+			}
+		}
+	}
+	materialize(iSection);
+
 	orderLinks();
+	gmenu2x->linkIndex.save();
 }
 
 #ifdef ENABLE_INOTIFY
@@ -770,6 +1098,7 @@ void Menu::removePackageLink(std::string path)
 				DEBUG("Removing link corresponding to package %s\n",
 							app->getOpkFile().c_str());
 				section->erase(link);
+				invalidate();
 				if (section - links.begin() == iSection
 							&& iLink == (int) section->size())
 					setLinkIndex(iLink - 1);
@@ -777,6 +1106,13 @@ void Menu::removePackageLink(std::string path)
 			}
 		}
 	}
+	for (auto& records : linkRecords) {
+		records.erase(remove_if(records.begin(), records.end(),
+				[&path](LinkRecord const& record) {
+					return record.desktop
+							&& record.file.compare(0, path.size(), path) == 0;
+				}), records.end());
+	}
 
 	/* Remove registered monitors */
 	for (auto it = monitors.begin(); it < monitors.end(); ++it) {
@@ -807,6 +1143,7 @@ void Menu::orderLinks()
 	for (auto& section : links) {
 		sort(section.begin(), section.end(), compare_links);
 	}
+	invalidate();
 }
 
 void Menu::readLinks()
@@ -816,6 +1153,7 @@ void Menu::readLinks()
 
 	for (uint i=0; i<links.size(); i++) {
 		links[i].clear();
+		linkRecords[i].clear();
 
 		int correct = (i>sections.size() ? iSection : i);
 		string const& section = sections[correct];
@@ -837,22 +1175,67 @@ void Menu::readLinksOfSection(std::string const& path, uint i)
 
 	while (struct dirent *dptr = readdir(dirp)) {
 		if (dptr->d_type != DT_REG) continue;
-		string linkfile = path + '/' + dptr->d_name;
-
-		LinkApp *link = new LinkApp(gmenu2x, linkfile, deletable);
-		if (link->targetExists()) {
-			link->setSize(
-					gmenu2x->skinConfInt["linkWidth"],
-					gmenu2x->skinConfInt["linkHeight"]);
-			links[i].push_back(link);
-		} else {
-			delete link;
-		}
+
+		LinkRecord record;
+		record.file = path + '/' + dptr->d_name;
+		record.deletable = deletable;
+		// The file exists, so its values are worth keeping in the index
+		// even if its section is not shown this time.
+		gmenu2x->linkIndex.keep(record.file);
+		linkRecords[i].push_back(move(record));
 	}
 
 	closedir(dirp);
 }
 
+void Menu::materialize(uint section)
+{
+	if (section >= linkRecords.size() || linkRecords[section].empty())
+		return;
+
+	vector<LinkRecord> records;
+	records.swap(linkRecords[section]);
+	for (LinkRecord const& record : records) {
+		LinkApp *link;
+#ifdef HAVE_LIBOPK
+		if (record.desktop) {
+			link = new LinkApp(gmenu2x, record.file, record.deletable,
+					record.desktop.get());
+		} else
+#endif
+		{
+			link = new LinkApp(gmenu2x, record.file, record.deletable);
+			if (!link->targetExists()) {
+				delete link;
+				continue;
+			}
+		}
+		link->setSize(
+				gmenu2x->skinConfInt["linkWidth"],
+				gmenu2x->skinConfInt["linkHeight"]);
+		links[section].push_back(link);
+	}
+	DEBUG("Created the links of section '%s'\n", sections[section].c_str());
+
+	sort(links[section].begin(), links[section].end(), compare_links);
+	invalidate();
+}
+
+void Menu::prefetchSection(int section)
+{
+	const int numSections = sections.size();
+	if (numSections == 0)
+		return;
+
+	section = (section % numSections + numSections) % numSections;
+	materialize(section);
+	for (Link *link : links[section]) {
+		gmenu2x->sc.request(link->getIconAsset());
+	}
+}
+
 void Menu::renameSection(int index, const string &name) {
 	sections[index] = name;
+	sectionStrip.reset();
+	invalidate();
 }
@@ -24,6 +24,7 @@
 #include "iconbutton.h"
 #include "layer.h"
 #include "link.h"
+#include "linkindex.h"
 
 #include <functional>
 #include <memory>
@@ -34,6 +35,7 @@ class GMenu2X;
 class IconButton;
 class LinkApp;
 class Monitor;
+class OffscreenSurface;
 
 
 /**
@@ -62,10 +64,56 @@ private:
 	std::vector<std::string> sections;
 	std::vector<std::vector<Link*>> links;
 
+	/**
+	 * A link that was found but is not created yet: links are created when
+	 * their section is first shown, see materialize().
+	 */
+	struct LinkRecord {
+		std::string file;
+		bool deletable;
+#ifdef HAVE_LIBOPK
+		/** For a link of a package: its desktop entry. */
+		std::unique_ptr<LinkIndex::Entry> desktop;
+#endif
+	};
+	/** The links of each section that are not created yet. */
+	std::vector<std::vector<LinkRecord>> linkRecords;
+
 	uint linkColumns, linkRows;
 
 	Animation sectionAnimation;
 
+	/** Skin images drawn on every paint. */
+	SurfaceCollection::AssetId sectionLeftAsset, sectionRightAsset;
+	SurfaceCollection::AssetId manualAsset, selectionAsset;
+
+	/**
+	 * The headers of all sections side by side, each in a cell of
+	 * sectionCellWidth pixels wide, wrapped to a new row of cells after
+	 * sectionStripColumns cells. Rendered on demand; reset whenever the
+	 * sections or their appearance change.
+	 */
+	std::unique_ptr<OffscreenSurface> sectionStrip;
+	int sectionCellWidth = 0;
+	int sectionStripColumns = 1;
+
+	/** Returns the area of the given section's header in the strip. */
+	SDL_Rect sectionCell(uint section);
+
+	void renderSectionStrip();
+
+	/** Selection state as it was when the menu was last painted. */
+	int paintedSection = -1, paintedLink = -1;
+	uint paintedFirstRow = 0;
+	/** The section animation value that was last painted. */
+	int paintedSectionOffset = 0;
+
+	/**
+	 * Marks the area covered by the given link of the current section,
+	 * including its selection highlight, as needing a repaint.
+	 */
+	void invalidateLink(int i);
+
 	/**
 	 * Determine which section headers are visible.
 	 * The output values are relative to the middle section at 0.
@@ -81,8 +129,12 @@ private:
 	void readSections(std::string parentDir);
 
 #ifdef HAVE_LIBOPK
-	// Load all the .opk packages of the given directory
-	void readPackages(std::string parentDir);
+	// Load all the .opk packages of the given directories
+	void readPackages(std::vector<std::string> const& dirs);
+	void openPackagesFromDirs(std::vector<std::string> const& dirs);
+	// Add the links of the given desktop entries of a package
+	void addPackageLinks(std::string const& path,
+			std::vector<LinkIndex::Entry> const& entries);
 #ifdef ENABLE_INOTIFY
 	std::vector<std::unique_ptr<Monitor>> monitors;
 #endif
@@ -91,6 +143,12 @@ private:
 	// Load all the links on the given section directory.
 	void readLinksOfSection(std::string const& path, uint i);
 
+	// Create the links of the given section that are not created yet.
+	void materialize(uint section);
+	// Create the links of a section that is likely to be shown next and
+	// start loading their icons.
+	void prefetchSection(int section);
+
 	void decSectionIndex();
 	void incSectionIndex();
 	void linkLeft();
@@ -130,6 +188,8 @@ public:
 	// Layer implementation:
 	virtual bool runAnimations();
 	virtual void paint(Surface &s);
+	virtual SDL_Rect takeDamage();
+	virtual bool isRetained();
 	virtual bool handleButtonPress(InputManager::Button button);
 	virtual bool handleTouchscreen(Touchscreen &ts);
 
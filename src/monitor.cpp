@@ -7,6 +7,7 @@
 #include <signal.h>
 #include <sys/inotify.h>
 #include <unistd.h>
+#include <utility>
 
 #include "inputmanager.h"
 #include "monitor.h"
@@ -27,11 +28,16 @@ bool Monitor::event_accepted(struct inotify_event &event)
 	return len >= 5 && !strncmp(event.name + len - 4, ".opk", 4);
 }
 
+static void close_fd(void *fd)
+{
+	close(*(int *) fd);
+}
+
 int Monitor::run()
 {
-	int wd, fd;
+	int fd;
 
-	DEBUG("Starting inotify thread for path %s...\n", path.c_str());
+	DEBUG("Starting inotify thread for path %s...\n", paths.front().c_str());
 
 	fd = inotify_init1(IN_CLOEXEC);
 	if (fd < 0) {
@@ -39,35 +45,62 @@ int Monitor::run()
 		return fd;
 	}
 
-	wd = inotify_add_watch(fd, path.c_str(), mask);
-	if (wd < 0) {
-		ERROR("Unable to add inotify watch\n");
-		close(fd);
-		return wd;
-	}
-
-	DEBUG("Starting watching directory %s\n", path.c_str());
-
-	for (;;) {
-		size_t len = sizeof(struct inotify_event) + NAME_MAX + 1;
-		struct inotify_event event;
-		char buf[256];
+	/* Cancelling the thread must not leak the inotify instance. */
+	pthread_cleanup_push(close_fd, &fd);
 
-		read(fd, &event, len);
+	/* The watch descriptors are small integers; index the paths by them. */
+	std::vector<const std::string *> watched;
+	size_t numWatched = 0;
+	for (std::string const& path : paths) {
+		int wd = inotify_add_watch(fd, path.c_str(), mask);
+		if (wd < 0) {
+			ERROR("Unable to add inotify watch for %s\n", path.c_str());
+			continue;
+		}
+		if ((size_t) wd >= watched.size()) {
+			watched.resize(wd + 1);
+		}
+		if (!watched[wd]) {
+			numWatched++;
+		}
+		watched[wd] = &path;
+		DEBUG("Starting watching directory %s\n", path.c_str());
+	}
 
-		if (event.mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
-			inject_event(false, path.c_str());
+	/* A read returns whole events only, each followed by its name. */
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	while (numWatched > 0) {
+		ssize_t len = read(fd, buf, sizeof(buf));
+		if (len <= 0) {
 			break;
 		}
 
-		sprintf(buf, "%s/%s", path.c_str(), event.name);
-
-		if (!event_accepted(event))
-			continue;
-
-		inject_event(event.mask & (IN_MOVED_TO | IN_CLOSE_WRITE | IN_CREATE), buf);
+		for (char *p = buf; p < buf + len; ) {
+			struct inotify_event &event = *(struct inotify_event *) p;
+			p += sizeof(struct inotify_event) + event.len;
+
+			if (event.wd < 0 || (size_t) event.wd >= watched.size()
+					|| !watched[event.wd]) {
+				continue;
+			}
+			const std::string &path = *watched[event.wd];
+
+			if (event.mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+				inject_event(false, path.c_str());
+				watched[event.wd] = nullptr;
+				numWatched--;
+				continue;
+			}
+			if (!event.len || !event_accepted(event))
+				continue;
+
+			std::string file = path + "/" + event.name;
+			inject_event(event.mask & (IN_MOVED_TO | IN_CLOSE_WRITE | IN_CREATE),
+					file.c_str());
+		}
 	}
 
+	pthread_cleanup_pop(1);
 	return 0;
 }
 
@@ -78,9 +111,21 @@ static void * inotify_thd(void *p)
 	return NULL;
 }
 
-Monitor::Monitor(std::string path, unsigned int flags) : path(path)
+Monitor::Monitor(std::string path, unsigned int flags)
+	: paths(1, path)
 {
 	mask = flags;
+	start();
+}
+
+Monitor::Monitor(std::vector<std::string> paths, unsigned int flags)
+	: paths(std::move(paths))
+{
+	mask = flags;
+}
+
+void Monitor::start()
+{
 	pthread_create(&thd, NULL, inotify_thd, (void *) this);
 }
 
@@ -88,6 +133,7 @@ Monitor::~Monitor()
 {
 	pthread_cancel(thd);
 	pthread_join(thd, NULL);
-	DEBUG("Monitor thread stopped (was watching %s)\n", path.c_str());
+	DEBUG("Monitor thread stopped (was watching %s and %zu more)\n",
+			paths.front().c_str(), paths.size() - 1);
 }
 #endif
@@ -5,23 +5,33 @@
 #include <pthread.h>
 #include <string>
 #include <sys/inotify.h>
+#include <vector>
 
 class Monitor {
 public:
 	Monitor(std::string path, unsigned int flags = IN_MOVE |
 				IN_CLOSE_WRITE | IN_DELETE | IN_CREATE |
 				IN_DELETE_SELF | IN_MOVE_SELF);
+	/**
+	 * Watches several directories with a single inotify instance and
+	 * thread. The thread stops once all directories are gone.
+	 * Unlike the other constructor, this does not start the thread: a
+	 * subclass calls start() once it is fully constructed, since the thread
+	 * calls its methods.
+	 */
+	Monitor(std::vector<std::string> paths, unsigned int flags);
 	virtual ~Monitor();
 
 	int run();
-	const std::string getPath() { return path; }
+	const std::string getPath() { return paths.front(); }
 
 private:
-	std::string path;
+	std::vector<std::string> paths;
 	pthread_t thd;
 
 protected:
 	unsigned int mask;
+	void start();
 	virtual bool event_accepted(struct inotify_event &event);
 	virtual void inject_event(bool is_add, const char *path);
 };
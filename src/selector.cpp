@@ -114,7 +114,8 @@ int Selector::exec(int startSelection) {
 			//Screenshot
 			if (fl.isFile(selected)) {
 				string path = screendir + trimExtension(fl[selected]) + ".png";
-				auto screenshot = OffscreenSurface::loadImage(path, false);
+				auto screenshot = OffscreenSurface::loadImage(
+						path, false, false, 320, 240);
 				if (screenshot) {
 					screenshot->blitRight(s, 320, 0, 320, 240, 128u);
 				}
@@ -149,7 +150,7 @@ int Selector::exec(int startSelection) {
 			s.clearClipRect();
 		}
 
-		gmenu2x->drawScrollBar(nb_elements, fl.size(), firstElement);
+		gmenu2x->drawScrollBar(s, nb_elements, fl.size(), firstElement);
 		s.flip();
 
 		switch (gmenu2x->input.waitForPressedButton()) {
@@ -111,7 +111,7 @@ bool SettingsDialog::exec() {
 			}
 		}
 
-		gmenu2x->drawScrollBar(numRows, settings.size(), firstElement);
+		gmenu2x->drawScrollBar(s, numRows, settings.size(), firstElement);
 
 		//description
 		writeSubTitle(s, settings[sel]->getDescription());
@@ -0,0 +1,166 @@
+// Various authors.
+// License: GPL version 2 or later.
+
+#include "skinbundle.h"
+
+#include "debug.h"
+
+#include <SDL.h>
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+unique_ptr<SkinBundle> SkinBundle::open(string const& dir) {
+	const string file = path(dir);
+	int fd = ::open(file.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return nullptr;
+	}
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(Header)) {
+		map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	if (map == MAP_FAILED) {
+		return nullptr;
+	}
+
+	const size_t size = st.st_size;
+	Header const& header = *static_cast<Header const*>(map);
+	const bool valid = header.magic == MAGIC
+			&& header.version == VERSION
+			&& header.endianMark == ENDIAN_MARK
+			&& header.valueOffset % alignof(Value) == 0
+			&& header.valueOffset <= size
+			&& header.numValues <= (size - header.valueOffset) / sizeof(Value)
+			&& header.imageOffset % alignof(Image) == 0
+			&& header.imageOffset <= size
+			&& header.numImages <= (size - header.imageOffset) / sizeof(Image);
+	if (!valid) {
+		WARNING("Ignoring invalid or outdated skin bundle '%s'\n", file.c_str());
+		munmap(map, size);
+		return nullptr;
+	}
+
+	DEBUG("Opened skin bundle '%s': %u values, %u images\n",
+			file.c_str(), header.numValues, header.numImages);
+	return unique_ptr<SkinBundle>(
+			new SkinBundle(dir, static_cast<const char *>(map), size));
+}
+
+SkinBundle::SkinBundle(string const& dir, const char *data, size_t size)
+	: dir(dir)
+	, data(data)
+	, size(size)
+{
+}
+
+SkinBundle::~SkinBundle()
+{
+	munmap(const_cast<char *>(data), size);
+}
+
+/* The offsets and lengths in the tables are checked on use, so a corrupt
+ * bundle cannot make us read outside the mapping. */
+static bool inBounds(size_t size, uint64_t offset, uint64_t length) {
+	return offset <= size && length <= size - offset;
+}
+
+unique_ptr<OffscreenSurface> SkinBundle::loadImage(string const& path) const {
+	if (path.size() <= dir.size() || path.compare(0, dir.size(), dir) != 0
+			|| path[dir.size()] != '/') {
+		return nullptr;
+	}
+	const char *name = path.c_str() + dir.size() + 1;
+	const size_t nameLength = path.size() - dir.size() - 1;
+
+	// Binary search in the sorted image table.
+	Image const* images =
+			reinterpret_cast<Image const*>(data + header().imageOffset);
+	Image const* end = images + header().numImages;
+	Image const* image = lower_bound(images, end, 0,
+			[this, name, nameLength](Image const& img, int) {
+				if (!inBounds(size, img.nameOffset, img.nameLength)) {
+					return false;
+				}
+				const int cmp = memcmp(data + img.nameOffset, name,
+						min<size_t>(img.nameLength, nameLength));
+				return cmp < 0 || (cmp == 0 && img.nameLength < nameLength);
+			});
+	if (image == end || image->nameLength != nameLength
+			|| !inBounds(size, image->nameOffset, nameLength)
+			|| memcmp(data + image->nameOffset, name, nameLength) != 0) {
+		return nullptr;
+	}
+
+	struct stat st;
+	if (stat(path.c_str(), &st) < 0
+			|| image->sourceTime != st.st_mtime
+			|| image->sourceSize != (uint64_t) st.st_size) {
+		DEBUG("Skin bundle image '%s' is outdated\n", path.c_str());
+		return nullptr;
+	}
+
+	const size_t rowBytes = (size_t) image->width * 4;
+	if (!inBounds(size, image->pixelOffset, rowBytes * image->height)) {
+		return nullptr;
+	}
+	SDL_Surface *raw = SDL_CreateRGBSurface(
+			SDL_SWSURFACE | SDL_SRCALPHA, image->width, image->height, 32,
+			0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+	if (!raw) {
+		return nullptr;
+	}
+	const char *pixels = data + image->pixelOffset;
+	for (uint32_t y = 0; y < image->height; y++) {
+		memcpy(static_cast<char *>(raw->pixels) + y * raw->pitch,
+				pixels + y * rowBytes, rowBytes);
+	}
+	return unique_ptr<OffscreenSurface>(
+			new OffscreenSurface(raw, image->premultiplied != 0));
+}
+
+bool SkinBundle::readConfig(
+		function<void(string const&, string const&)> setString,
+		function<void(string const&, int)> setInt,
+		function<void(string const&, RGBAColor)> setColor) const
+{
+	struct stat st;
+	if (header().numValues == 0 || stat((dir + "/skin.conf").c_str(), &st) < 0
+			|| header().confTime != st.st_mtime
+			|| header().confSize != (uint64_t) st.st_size) {
+		return false;
+	}
+
+	Value const* values =
+			reinterpret_cast<Value const*>(data + header().valueOffset);
+	for (uint32_t i = 0; i < header().numValues; i++) {
+		Value const& value = values[i];
+		if (!inBounds(size, value.nameOffset, value.nameLength)) {
+			continue;
+		}
+		const string name = text(value.nameOffset, value.nameLength);
+		switch (value.type) {
+			case STRING:
+				if (inBounds(size, value.stringOffset, value.stringLength)) {
+					setString(name,
+							text(value.stringOffset, value.stringLength));
+				}
+				break;
+			case INT:
+				setInt(name, value.intValue);
+				break;
+			case COLOR:
+				setColor(name, RGBAColor(value.color[0], value.color[1],
+						value.color[2], value.color[3]));
+				break;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,113 @@
+// Various authors.
+// License: GPL version 2 or later.
+
+#ifndef SKINBUNDLE_H
+#define SKINBUNDLE_H
+
+#include "surface.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+/**
+ * A compiled skin: the parsed skin.conf and the decoded images of a skin
+ * directory in a single file, "skin.bundle" inside that directory.
+ * Bundles are made by gmenu2x-skincompiler and are read with one mmap.
+ *
+ * A bundle speeds up loading a skin but does not replace its directory:
+ * other files, such as fonts, are still read from there. Values of a
+ * skin.conf or image file that changed after the bundle was compiled are
+ * ignored, so an outdated bundle is harmless.
+ */
+class SkinBundle {
+public:
+	/** The layout of a bundle file; all offsets are from its start. */
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		/** ENDIAN_MARK as written by the compiler. */
+		uint32_t endianMark;
+		/** The skin.conf the values were parsed from; 0 if none. */
+		int64_t confTime;
+		uint64_t confSize;
+		uint32_t numValues, valueOffset;
+		/** The images, sorted by name. */
+		uint32_t numImages, imageOffset;
+	};
+	enum ValueType : uint32_t { STRING, INT, COLOR };
+	struct Value {
+		uint32_t nameOffset, nameLength;
+		uint32_t type;
+		/** For STRING values. */
+		uint32_t stringOffset, stringLength;
+		/** For INT values. */
+		int32_t intValue;
+		/** For COLOR values: red, green, blue and alpha. */
+		uint8_t color[4];
+	};
+	/**
+	 * An image in premultiplied 32bpp ARGB, as loaded by loadImageFile();
+	 * rows of width * 4 bytes at a multiple of 16 bytes.
+	 */
+	struct Image {
+		uint32_t nameOffset, nameLength;
+		int64_t sourceTime;
+		uint64_t sourceSize;
+		uint32_t width, height;
+		uint32_t pixelOffset;
+		uint32_t premultiplied;
+	};
+	static const uint32_t MAGIC = 0x4B534D47; // "GMSK" in little endian
+	static const uint32_t VERSION = 1;
+	static const uint32_t ENDIAN_MARK = 0x01020304;
+
+	/**
+	 * Opens the bundle of the given skin directory. Returns nullptr if
+	 * there is none or it cannot be used.
+	 */
+	static std::unique_ptr<SkinBundle> open(std::string const& dir);
+
+	/** Returns the path of the bundle of the given skin directory. */
+	static std::string path(std::string const& dir) {
+		return dir + "/skin.bundle";
+	}
+	~SkinBundle();
+
+	std::string const& getDir() const { return dir; }
+
+	/**
+	 * Loads the image at the given path, which must be inside the skin
+	 * directory. Returns nullptr if the bundle does not hold the image or
+	 * the file changed since the bundle was compiled.
+	 */
+	std::unique_ptr<OffscreenSurface> loadImage(std::string const& path) const;
+
+	/**
+	 * Passes the values of the skin's configuration to the given functions.
+	 * Returns false, without passing anything, if the bundle holds no
+	 * configuration or skin.conf changed since the bundle was compiled.
+	 */
+	bool readConfig(
+			std::function<void(std::string const&, std::string const&)> setString,
+			std::function<void(std::string const&, int)> setInt,
+			std::function<void(std::string const&, RGBAColor)> setColor) const;
+
+private:
+	SkinBundle(std::string const& dir, const char *data, size_t size);
+
+	std::string text(uint32_t offset, uint32_t length) const {
+		return std::string(data + offset, length);
+	}
+	Header const& header() const {
+		return *reinterpret_cast<Header const*>(data);
+	}
+
+	const std::string dir;
+	const char *const data;
+	const size_t size;
+};
+
+#endif
@@ -0,0 +1,232 @@
+// Various authors.
+// License: GPL version 2 or later.
+
+// Compiles a skin directory into a skin bundle; see skinbundle.h.
+// Usage: gmenu2x-skincompiler <skin directory>...
+
+#include "skinbundle.h"
+
+#include "imageio.h"
+#include "surface.h"
+#include "utilities.h"
+
+#include <SDL.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <string>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+struct ConfValue {
+	string name, str;
+	SkinBundle::ValueType type;
+	int intValue;
+	uint8_t color[4];
+};
+
+struct ImageFile {
+	string name, path;
+	struct stat st;
+};
+
+}
+
+/* Parses skin.conf the same way GMenu2X::readSkinConfig() does. */
+static bool parseConfig(string const& file, vector<ConfValue> &values) {
+	ifstream skinconf(file.c_str(), ios_base::in);
+	if (!skinconf.is_open()) {
+		return false;
+	}
+	string line;
+	while (getline(skinconf, line, '\n')) {
+		line = trim(line);
+		string::size_type pos = line.find("=");
+		string name = trim(line.substr(0,pos));
+		string value = trim(line.substr(pos+1,line.length()));
+		if (value.empty()) {
+			continue;
+		}
+
+		ConfValue v = ConfValue();
+		v.name = name;
+		if (value.length()>1 && value.at(0)=='"' && value.at(value.length()-1)=='"') {
+			v.type = SkinBundle::STRING;
+			v.str = value.substr(1,value.length()-2);
+		} else if (value.at(0) == '#') {
+			v.type = SkinBundle::COLOR;
+			const RGBAColor color =
+					RGBAColor::fromString(value.substr(1, value.length()));
+			v.color[0] = color.r;
+			v.color[1] = color.g;
+			v.color[2] = color.b;
+			v.color[3] = color.a;
+		} else {
+			v.type = SkinBundle::INT;
+			v.intValue = atoi(value.c_str());
+		}
+		values.push_back(v);
+	}
+	return true;
+}
+
+static bool isImage(string const& name) {
+	if (name.size() <= 4) return false;
+	const char *ext = name.c_str() + name.size() - 4;
+	return strcasecmp(ext, ".png") == 0 || strcasecmp(ext, ".qoi") == 0;
+}
+
+static void findImages(string const& dir, string const& prefix,
+		vector<ImageFile> &images)
+{
+	DIR *dirp = opendir(dir.c_str());
+	if (!dirp) return;
+	while (struct dirent *dptr = readdir(dirp)) {
+		if (dptr->d_name[0] == '.') continue;
+		ImageFile file;
+		file.name = prefix + dptr->d_name;
+		file.path = dir + '/' + dptr->d_name;
+		if (stat(file.path.c_str(), &file.st) < 0) continue;
+		if (S_ISDIR(file.st.st_mode)) {
+			findImages(file.path, file.name + '/', images);
+		} else if (isImage(file.name)) {
+			images.push_back(file);
+		}
+	}
+	closedir(dirp);
+}
+
+static size_t align(vector<char> &out, size_t alignment) {
+	out.resize((out.size() + alignment - 1) / alignment * alignment);
+	return out.size();
+}
+
+static uint32_t append(vector<char> &out, const void *data, size_t length) {
+	const size_t offset = out.size();
+	out.insert(out.end(), static_cast<const char *>(data),
+			static_cast<const char *>(data) + length);
+	return offset;
+}
+
+static bool compile(string const& dir) {
+	SkinBundle::Header header = SkinBundle::Header();
+	header.magic = SkinBundle::MAGIC;
+	header.version = SkinBundle::VERSION;
+	header.endianMark = SkinBundle::ENDIAN_MARK;
+
+	vector<ConfValue> conf;
+	const string confFile = dir + "/skin.conf";
+	struct stat st;
+	if (parseConfig(confFile, conf) && stat(confFile.c_str(), &st) == 0) {
+		header.confTime = st.st_mtime;
+		header.confSize = st.st_size;
+	}
+
+	vector<ImageFile> files;
+	findImages(dir, "", files);
+	sort(files.begin(), files.end(), [](ImageFile const& a, ImageFile const& b) {
+		return a.name < b.name;
+	});
+
+	// Tables first, then names and strings, then the pixels.
+	vector<char> out(sizeof(header));
+	header.numValues = conf.size();
+	header.valueOffset = align(out, alignof(SkinBundle::Value));
+	out.resize(out.size() + conf.size() * sizeof(SkinBundle::Value));
+	header.imageOffset = align(out, alignof(SkinBundle::Image));
+	out.resize(out.size() + files.size() * sizeof(SkinBundle::Image));
+
+	vector<SkinBundle::Value> values(conf.size());
+	for (size_t i = 0; i < conf.size(); i++) {
+		SkinBundle::Value &value = values[i];
+		value.nameOffset = append(out, conf[i].name.data(), conf[i].name.size());
+		value.nameLength = conf[i].name.size();
+		value.type = conf[i].type;
+		value.stringOffset = append(out, conf[i].str.data(), conf[i].str.size());
+		value.stringLength = conf[i].str.size();
+		value.intValue = conf[i].intValue;
+		memcpy(value.color, conf[i].color, sizeof(value.color));
+	}
+
+	vector<SkinBundle::Image> images;
+	for (ImageFile const& file : files) {
+		SDL_Surface *surface = loadImageFile(file.path, true, true);
+		if (!surface) {
+			fprintf(stderr, "Skipping unreadable image: %s\n", file.path.c_str());
+			continue;
+		}
+		SkinBundle::Image image = SkinBundle::Image();
+		image.nameOffset = append(out, file.name.data(), file.name.size());
+		image.nameLength = file.name.size();
+		image.sourceTime = file.st.st_mtime;
+		image.sourceSize = file.st.st_size;
+		image.width = surface->w;
+		image.height = surface->h;
+		image.premultiplied = 1;
+		image.pixelOffset = align(out, 16);
+		for (int y = 0; y < surface->h; y++) {
+			append(out, static_cast<const char *>(surface->pixels)
+					+ y * surface->pitch, surface->w * 4);
+		}
+		SDL_FreeSurface(surface);
+		images.push_back(image);
+	}
+	header.numImages = images.size();
+
+	memcpy(&out[0], &header, sizeof(header));
+	if (!values.empty()) {
+		memcpy(&out[header.valueOffset], &values[0],
+				values.size() * sizeof(SkinBundle::Value));
+	}
+	if (!images.empty()) {
+		memcpy(&out[header.imageOffset], &images[0],
+				images.size() * sizeof(SkinBundle::Image));
+	}
+
+	// Replace the old bundle atomically; a running menu may have it mapped.
+	const string file = SkinBundle::path(dir);
+	const string tmp = file + ".tmp";
+	FILE *fp = fopen(tmp.c_str(), "wb");
+	if (!fp) {
+		fprintf(stderr, "Unable to create %s\n", tmp.c_str());
+		return false;
+	}
+	bool ok = fwrite(&out[0], 1, out.size(), fp) == out.size();
+	ok = fclose(fp) == 0 && ok;
+	if (!ok || rename(tmp.c_str(), file.c_str()) < 0) {
+		fprintf(stderr, "Unable to write %s\n", file.c_str());
+		unlink(tmp.c_str());
+		return false;
+	}
+
+	printf("%s: %zu values, %zu images, %zu bytes\n", file.c_str(),
+			values.size(), images.size(), out.size());
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <skin directory>...\n", argv[0]);
+		return 2;
+	}
+	int ret = 0;
+	for (int i = 1; i < argc; i++) {
+		string dir = argv[i];
+		while (dir.size() > 1 && dir[dir.size() - 1] == '/') {
+			dir.erase(dir.size() - 1);
+		}
+		if (!compile(dir)) {
+			ret = 1;
+		}
+	}
+	return ret;
+}
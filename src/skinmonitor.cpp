@@ -0,0 +1,31 @@
+#ifdef ENABLE_INOTIFY
+#include <sys/inotify.h>
+#include <utility>
+
+#include "debug.h"
+#include "skinmonitor.h"
+#include "surfacecollection.h"
+
+SkinMonitor::SkinMonitor(std::vector<std::string> dirs, SurfaceCollection &sc) :
+	Monitor(std::move(dirs), IN_MOVE | IN_DELETE | IN_CREATE |
+				IN_DELETE_SELF | IN_MOVE_SELF),
+	sc(sc)
+{
+	start();
+}
+
+bool SkinMonitor::event_accepted(
+			struct inotify_event &event __attribute__((unused)))
+{
+	return true;
+}
+
+void SkinMonitor::inject_event(
+			bool is_add __attribute__((unused)),
+			const char *path __attribute__((unused)))
+{
+	DEBUG("Skin file changed: %s\n", path);
+	sc.invalidateSkinIndex();
+}
+
+#endif /* ENABLE_INOTIFY */
@@ -0,0 +1,26 @@
+#ifndef __SKINMONITOR_H__
+#define __SKINMONITOR_H__
+#ifdef ENABLE_INOTIFY
+
+#include "monitor.h"
+
+class SurfaceCollection;
+
+/**
+ * Watches the directories of a skin and invalidates the skin file index of
+ * the surface collection when files are added, removed or renamed.
+ */
+class SkinMonitor: public Monitor {
+	public:
+		SkinMonitor(std::vector<std::string> dirs, SurfaceCollection &sc);
+		virtual ~SkinMonitor() { };
+
+	private:
+		SurfaceCollection &sc;
+
+		virtual bool event_accepted(struct inotify_event &event);
+		virtual void inject_event(bool is_add, const char *path);
+};
+
+#endif /* ENABLE_INOTIFY */
+#endif /* __SKINMONITOR_H__ */
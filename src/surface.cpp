@@ -20,6 +20,7 @@
 
 #include "surface.h"
 
+#include "blend.h"
 #include "debug.h"
 #include "imageio.h"
 #include "utilities.h"
@@ -60,11 +61,37 @@ ostream& operator<<(ostream& os, RGBAColor const& color) {
 	return os;
 }
 
+SDL_Rect rectUnion(SDL_Rect const& a, SDL_Rect const& b) {
+	if (a.w == 0 || a.h == 0) return b;
+	if (b.w == 0 || b.h == 0) return a;
+	const int x1 = max(a.x + a.w, b.x + b.w);
+	const int y1 = max(a.y + a.h, b.y + b.h);
+	const Sint16 x = min(a.x, b.x), y = min(a.y, b.y);
+	return (SDL_Rect) {
+		x, y, static_cast<Uint16>(min(x1 - x, 0xFFFF)),
+		static_cast<Uint16>(min(y1 - y, 0xFFFF))
+	};
+}
+
+SDL_Rect rectIntersection(SDL_Rect const& a, SDL_Rect const& b) {
+	const int x0 = max(a.x, b.x), y0 = max(a.y, b.y);
+	const int x1 = min(a.x + a.w, b.x + b.w);
+	const int y1 = min(a.y + a.h, b.y + b.h);
+	if (x1 <= x0 || y1 <= y0) {
+		return (SDL_Rect) { 0, 0, 0, 0 };
+	}
+	return (SDL_Rect) {
+		static_cast<Sint16>(x0), static_cast<Sint16>(y0),
+		static_cast<Uint16>(x1 - x0), static_cast<Uint16>(y1 - y0)
+	};
+}
+
 
 // Surface:
 
 Surface::Surface(Surface const& other)
-	: Surface(SDL_ConvertSurface(other.raw, other.raw->format, SDL_SWSURFACE))
+	: Surface(SDL_ConvertSurface(other.raw, other.raw->format, SDL_SWSURFACE),
+	          other.premultiplied)
 {
 	// Note: A bug in SDL_ConvertSurface() leaves the per-surface alpha
 	//       undefined when converting from RGBA to RGBA. This can cause
@@ -77,6 +104,13 @@ void Surface::blit(SDL_Surface *destination, int x, int y, int w, int h, int a)
 	if (destination == NULL || a==0) return;
 
 	SDL_Rect src = { 0, 0, static_cast<Uint16>(w), static_cast<Uint16>(h) };
+	if (premultiplied) {
+		// Global alpha is applied while blending; "raw" is left untouched.
+		blitPremultiplied(raw, (w==0 || h==0) ? NULL : &src,
+				destination, x, y, a>0 ? min(a, 255) : 255);
+		return;
+	}
+
 	SDL_Rect dest;
 	dest.x = x;
 	dest.y = y;
@@ -106,6 +140,18 @@ void Surface::blitRight(Surface& destination, int x, int y, int w, int h, int a)
 	blitRight(destination.raw, x, y, w, h, a);
 }
 
+void Surface::blitPart(Surface& destination, SDL_Rect part, int x, int y) const {
+	if (premultiplied) {
+		blitPremultiplied(raw, &part, destination.raw, x, y, 255);
+		return;
+	}
+
+	SDL_Rect dest;
+	dest.x = x;
+	dest.y = y;
+	SDL_BlitSurface(raw, &part, destination.raw, &dest);
+}
+
 void Surface::box(SDL_Rect re, RGBAColor c) {
 	if (c.a == 255) {
 		SDL_FillRect(raw, &re, c.pixelValue(raw->format));
@@ -245,29 +291,14 @@ void Surface::fillRectAlpha(SDL_Rect rect, RGBAColor c) {
 		           | format->Amask;
 		alpha = 255 - alpha;
 
-		for (auto y = 0; y < rect.h; y++) {
-			for (auto x = 0; x < rect.w; x++) {
-				uint16_t& pixel = reinterpret_cast<uint16_t*>(edge)[x];
-				uint32_t R = ((pixel & Rmask) * alpha >> 8) & Rmask;
-				uint32_t G = ((pixel & Gmask) * alpha >> 8) & Gmask;
-				uint32_t B = ((pixel & Bmask) * alpha >> 8) & Bmask;
-				pixel = uint16_t(R | G | B) + f;
-			}
-			edge += raw->pitch;
-		}
+		fillAlpha16(edge, raw->pitch, rect.w, rect.h, *format, f, alpha);
 	} else if (format->BytesPerPixel == 4) {
 		// Assume the pixel format uses 8 bits per component; we don't care
 		// which component is where since they all blend the same.
 		uint32_t f = mult8x4(color, alpha); // pre-multiply the fill color
 		alpha = 255 - alpha;
 
-		for (auto y = 0; y < rect.h; y++) {
-			for (auto x = 0; x < rect.w; x++) {
-				uint32_t& pixel = reinterpret_cast<uint32_t*>(edge)[x];
-				pixel = mult8x4(pixel, alpha) + f;
-			}
-			edge += raw->pitch;
-		}
+		fillAlpha32(edge, raw->pitch, rect.w, rect.h, f, alpha);
 	} else {
 		assert(false);
 	}
@@ -290,10 +321,44 @@ unique_ptr<OffscreenSurface> OffscreenSurface::emptySurface(
 	return unique_ptr<OffscreenSurface>(new OffscreenSurface(raw));
 }
 
+unique_ptr<OffscreenSurface> OffscreenSurface::transparentSurface(
+		int width, int height)
+{
+	// Same layout as the premultiplied images from loadImageFile().
+	SDL_Surface *raw = SDL_CreateRGBSurface(
+			SDL_SWSURFACE, width, height, 32,
+			0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+	if (!raw) return unique_ptr<OffscreenSurface>();
+	SDL_FillRect(raw, nullptr, 0);
+	return unique_ptr<OffscreenSurface>(new OffscreenSurface(raw, true));
+}
+
 unique_ptr<OffscreenSurface> OffscreenSurface::loadImage(
-		string const& img, bool loadAlpha)
+		string const& img, bool loadAlpha, bool premultiply,
+		unsigned int maxWidth, unsigned int maxHeight)
+{
+	premultiply = premultiply && loadAlpha;
+	SDL_Surface *raw = loadImageFile(img, loadAlpha, premultiply, maxWidth, maxHeight);
+	if (!raw) {
+		DEBUG("Couldn't load surface '%s'\n", img.c_str());
+		return unique_ptr<OffscreenSurface>();
+	}
+
+	return unique_ptr<OffscreenSurface>(new OffscreenSurface(raw, premultiply));
+}
+
+unique_ptr<OffscreenSurface> OffscreenSurface::loadImageInDisplayFormat(
+		string const& img, bool dither)
 {
-	SDL_Surface *raw = loadPNG(img, loadAlpha);
+	SDL_Surface *screen = SDL_GetVideoSurface();
+	if (!screen) {
+		return loadImage(img, false);
+	}
+	SDL_PixelFormat format = *screen->format;
+	format.Amask = 0;
+	format.Aloss = 8;
+	format.Ashift = 0;
+	SDL_Surface *raw = loadImageFile(img, format, dither);
 	if (!raw) {
 		DEBUG("Couldn't load surface '%s'\n", img.c_str());
 		return unique_ptr<OffscreenSurface>();
@@ -303,7 +368,7 @@ unique_ptr<OffscreenSurface> OffscreenSurface::loadImage(
 }
 
 OffscreenSurface::OffscreenSurface(OffscreenSurface&& other)
-	: Surface(other.raw)
+	: Surface(other.raw, other.premultiplied)
 {
 	other.raw = nullptr;
 }
@@ -322,6 +387,159 @@ OffscreenSurface& OffscreenSurface::operator=(OffscreenSurface other)
 void OffscreenSurface::swap(OffscreenSurface& other)
 {
 	std::swap(raw, other.raw);
+	std::swap(premultiplied, other.premultiplied);
+}
+
+const char *OffscreenSurface::formatName(Format format) {
+	switch (format) {
+		case Format::DISPLAY:       return "display";
+		case Format::COLOR_KEY:     return "color key";
+		case Format::PREMULTIPLIED: return "premultiplied";
+		case Format::ORIGINAL:      return "original";
+	}
+	return "?";
+}
+
+OffscreenSurface::Format OffscreenSurface::convertForDisplay() {
+	SDL_PixelFormat const& format = *raw->format;
+	const bool argb = format.BytesPerPixel == 4 && format.Amask == 0xFF000000
+			&& format.Rmask == 0x00FF0000 && format.Gmask == 0x0000FF00
+			&& format.Bmask == 0x000000FF;
+	const Format current = premultiplied ? Format::PREMULTIPLIED : Format::ORIGINAL;
+	if (!SDL_GetVideoSurface() || (format.Amask && !argb)) {
+		return current;
+	}
+
+	// Find out whether the alpha channel is needed and if so, whether a
+	// color key suffices.
+	bool opaque = true, binary = true;
+	if (format.Amask) {
+		if (SDL_MUSTLOCK(raw) && SDL_LockSurface(raw) < 0) {
+			return current;
+		}
+		for (int y = 0; y < raw->h && binary; y++) {
+			const Uint32 *row = reinterpret_cast<const Uint32 *>(
+					static_cast<const Uint8 *>(raw->pixels) + y * raw->pitch);
+			for (int x = 0; x < raw->w; x++) {
+				const Uint32 alpha = row[x] >> 24;
+				if (alpha != 255) {
+					opaque = false;
+					if (alpha != 0) {
+						binary = false;
+						break;
+					}
+				}
+			}
+		}
+		if (SDL_MUSTLOCK(raw)) {
+			SDL_UnlockSurface(raw);
+		}
+	}
+
+	if (opaque) {
+		SDL_Surface *original = raw;
+		convertToDisplayFormat();
+		return raw == original ? current : Format::DISPLAY;
+	}
+	if (binary && convertToColorKey()) {
+		return Format::COLOR_KEY;
+	}
+	if (!premultiplied) {
+		if (SDL_MUSTLOCK(raw) && SDL_LockSurface(raw) < 0) {
+			return Format::ORIGINAL;
+		}
+		premultiplyAlpha(static_cast<uint8_t *>(raw->pixels),
+				raw->pitch, raw->w, raw->h);
+		if (SDL_MUSTLOCK(raw)) {
+			SDL_UnlockSurface(raw);
+		}
+		premultiplied = true;
+	}
+	return Format::PREMULTIPLIED;
+}
+
+bool OffscreenSurface::convertToColorKey() {
+	// The transparent pixels end up black, which is replaced by the key.
+	SDL_Surface *converted = SDL_DisplayFormat(raw);
+	if (!converted) {
+		return false;
+	}
+	const int bpp = converted->format->BytesPerPixel;
+	if ((bpp != 2 && bpp != 4)
+			|| (SDL_MUSTLOCK(converted) && SDL_LockSurface(converted) < 0)) {
+		SDL_FreeSurface(converted);
+		return false;
+	}
+	if (SDL_MUSTLOCK(raw) && SDL_LockSurface(raw) < 0) {
+		if (SDL_MUSTLOCK(converted)) {
+			SDL_UnlockSurface(converted);
+		}
+		SDL_FreeSurface(converted);
+		return false;
+	}
+
+	auto pixelAt = [converted, bpp](int x, int y) -> Uint8 * {
+		return static_cast<Uint8 *>(converted->pixels)
+				+ y * converted->pitch + x * bpp;
+	};
+	auto isTransparent = [this](int x, int y) {
+		return (reinterpret_cast<const Uint32 *>(
+				static_cast<const Uint8 *>(raw->pixels) + y * raw->pitch)[x]
+				>> 24) == 0;
+	};
+
+	// Pick a key that no opaque pixel uses, preferably magenta.
+	vector<Uint32> used;
+	for (int y = 0; y < raw->h; y++) {
+		for (int x = 0; x < raw->w; x++) {
+			if (!isTransparent(x, y)) {
+				const Uint8 *p = pixelAt(x, y);
+				used.push_back(bpp == 2 ? *reinterpret_cast<const Uint16 *>(p)
+						: *reinterpret_cast<const Uint32 *>(p));
+			}
+		}
+	}
+	sort(used.begin(), used.end());
+	SDL_PixelFormat const& format = *converted->format;
+	const Uint32 colorMask = format.Rmask | format.Gmask | format.Bmask;
+	Uint32 key = SDL_MapRGB(&format, 255, 0, 255);
+	for (size_t tries = 0; binary_search(used.begin(), used.end(), key)
+			&& tries <= used.size(); tries++) {
+		key = (key + 1) & colorMask;
+	}
+
+	const bool found = !binary_search(used.begin(), used.end(), key);
+	if (found) {
+		for (int y = 0; y < raw->h; y++) {
+			for (int x = 0; x < raw->w; x++) {
+				if (isTransparent(x, y)) {
+					Uint8 *p = pixelAt(x, y);
+					if (bpp == 2) {
+						*reinterpret_cast<Uint16 *>(p) = key;
+					} else {
+						*reinterpret_cast<Uint32 *>(p) = key;
+					}
+				}
+			}
+		}
+	}
+
+	if (SDL_MUSTLOCK(raw)) {
+		SDL_UnlockSurface(raw);
+	}
+	if (SDL_MUSTLOCK(converted)) {
+		SDL_UnlockSurface(converted);
+	}
+	if (!found) {
+		SDL_FreeSurface(converted);
+		return false;
+	}
+
+	SDL_SetColorKey(converted, SDL_SRCCOLORKEY | SDL_RLEACCEL, key);
+	SDL_FreeSurface(raw);
+	raw = converted;
+	premultiplied = false;
+	return true;
 }
 
 void OffscreenSurface::convertToDisplayFormat() {
@@ -329,6 +547,7 @@ void OffscreenSurface::convertToDisplayFormat() {
 	if (newSurface) {
 		SDL_FreeSurface(raw);
 		raw = newSurface;
+		premultiplied = false;
 	}
 }
 
@@ -344,6 +563,51 @@ unique_ptr<OutputSurface> OutputSurface::open(
 	return unique_ptr<OutputSurface>(raw ? new OutputSurface(raw) : nullptr);
 }
 
+OutputSurface::OutputSurface(SDL_Surface *raw)
+	: Surface(raw)
+{
+	stale = staleOther = screenRect();
+}
+
+SDL_Rect OutputSurface::screenRect() const {
+	return (SDL_Rect) {
+		0, 0, static_cast<Uint16>(raw->w), static_cast<Uint16>(raw->h)
+	};
+}
+
 void OutputSurface::flip() {
 	SDL_Flip(raw);
+	// Whoever drew this frame, it wasn't the damage tracking: all buffers
+	// have to be repainted completely.
+	stale = staleOther = screenRect();
+	fullFlips++;
+}
+
+SDL_Rect OutputSurface::getRepaintArea(SDL_Rect const& damage) {
+	const SDL_Rect screen = screenRect();
+	const SDL_Rect area = rectIntersection(rectUnion(damage, stale), screen);
+	if (area.w == 0 || area.h == 0) {
+		return area;
+	}
+	if (raw->flags & SDL_DOUBLEBUF) {
+		// After the flip, we'll draw into the other buffer, which misses
+		// what it was missing already plus this frame's damage.
+		stale = rectIntersection(rectUnion(damage, staleOther), screen);
+		staleOther = (SDL_Rect) { 0, 0, 0, 0 };
+	} else {
+		stale = (SDL_Rect) { 0, 0, 0, 0 };
+	}
+	return area;
+}
+
+void OutputSurface::flip(SDL_Rect const& area) {
+	if (area.w == 0 || area.h == 0) {
+		return;
+	}
+	if (raw->flags & SDL_DOUBLEBUF) {
+		SDL_Flip(raw);
+	} else {
+		SDL_Rect rect = area;
+		SDL_UpdateRects(raw, 1, &rect);
+	}
 }
@@ -43,6 +43,17 @@ struct RGBAColor {
 };
 std::ostream& operator<<(std::ostream& os, RGBAColor const& color);
 
+/**
+ * Returns the smallest rectangle that contains both given rectangles.
+ * Empty rectangles are ignored.
+ */
+SDL_Rect rectUnion(SDL_Rect const& a, SDL_Rect const& b);
+
+/**
+ * Returns the overlap of the given rectangles, which may be empty.
+ */
+SDL_Rect rectIntersection(SDL_Rect const& a, SDL_Rect const& b);
+
 /**
  * Abstract base class for surfaces; wraps SDL_Surface.
  */
@@ -52,6 +63,13 @@ public:
 
 	int width() const { return raw->w; }
 	int height() const { return raw->h; }
+	/**
+	 * Returns the number of bytes used by the pixels of this surface, not
+	 * counting the padding at the end of each row.
+	 */
+	size_t byteSize() const {
+		return static_cast<size_t>(raw->w) * raw->format->BytesPerPixel * raw->h;
+	}
 
 	void clearClipRect();
 	void setClipRect(int x, int y, int w, int h);
@@ -61,6 +79,11 @@ public:
 	void blit(Surface& destination, SDL_Rect container, Font::HAlign halign = Font::HAlignLeft, Font::VAlign valign = Font::VAlignTop) const;
 	void blitCenter(Surface& destination, int x, int y, int w=0, int h=0, int a=-1) const;
 	void blitRight(Surface& destination, int x, int y, int w=0, int h=0, int a=-1) const;
+	/**
+	 * Draws the given part of this surface with its top left corner at
+	 * the given position.
+	 */
+	void blitPart(Surface& destination, SDL_Rect part, int x, int y) const;
 
 	void box(SDL_Rect re, RGBAColor c);
 	void box(Sint16 x, Sint16 y, Uint16 w, Uint16 h, RGBAColor c) {
@@ -77,11 +100,19 @@ public:
 		rectangle((SDL_Rect){ x, y, w, h }, RGBAColor(r, g, b, a));
 	}
 
+	/**
+	 * Returns true iff the color components of this surface are multiplied
+	 * by its alpha channel. Such surfaces are drawn by a dedicated blitter.
+	 */
+	bool isPremultiplied() const { return premultiplied; }
+
 protected:
-	Surface(SDL_Surface *raw) : raw(raw) {}
+	Surface(SDL_Surface *raw, bool premultiplied = false)
+		: raw(raw), premultiplied(premultiplied) {}
 	Surface(Surface const& other);
 
 	SDL_Surface *raw;
+	bool premultiplied;
 
 	// For direct access to "raw".
 	friend class Font;
@@ -107,10 +138,47 @@ private:
  */
 class OffscreenSurface: public Surface {
 public:
+	/**
+	 * The ways in which an image can be stored for drawing it on the screen,
+	 * from fastest to slowest to draw.
+	 */
+	enum class Format {
+		DISPLAY,       //!< Opaque, in the display format.
+		COLOR_KEY,     //!< Display format with an RLE accelerated color key.
+		PREMULTIPLIED, //!< Premultiplied ARGB, drawn by blitPremultiplied().
+		ORIGINAL,      //!< As loaded, drawn by SDL with conversion.
+	};
+
+	static const char *formatName(Format format);
+
 	static std::unique_ptr<OffscreenSurface> emptySurface(
 			int width, int height);
+	/**
+	 * Creates a fully transparent surface with premultiplied alpha, to
+	 * compose an image out of other images and text that is drawn later.
+	 */
+	static std::unique_ptr<OffscreenSurface> transparentSurface(
+			int width, int height);
+	/**
+	 * Loads an image from a file. If premultiply is true and the image has
+	 * an alpha channel, the surface is created with premultiplied alpha,
+	 * which is faster to draw but cannot be drawn upon.
+	 * If maxWidth and maxHeight are not zero, a larger image is shrunk while
+	 * it is decoded to fit in a box of that size.
+	 */
 	static std::unique_ptr<OffscreenSurface> loadImage(
-			std::string const& img, bool loadAlpha = true);
+			std::string const& img, bool loadAlpha = true,
+			bool premultiply = false,
+			unsigned int maxWidth = 0, unsigned int maxHeight = 0);
+	/**
+	 * Loads an image from a file straight into the display format,
+	 * ignoring its alpha channel. This is the same as loadImage() without
+	 * alpha followed by convertToDisplayFormat(), but without the second
+	 * copy of the image. If dither is true, a display with fewer than 8
+	 * bits per color component gets an ordered dither.
+	 */
+	static std::unique_ptr<OffscreenSurface> loadImageInDisplayFormat(
+			std::string const& img, bool dither = false);
 
 	OffscreenSurface(Surface const& other) : Surface(other) {}
 	OffscreenSurface(OffscreenSurface const& other) : Surface(other) {}
@@ -122,12 +190,30 @@ public:
 	/**
 	 * Converts the underlying surface to the same pixel format as the frame
 	 * buffer, for faster blitting. This removes the alpha channel if the
-	 * image has one.
+	 * image has one; a premultiplied image ends up as if drawn over black.
 	 */
 	void convertToDisplayFormat();
 
+	/**
+	 * Converts the underlying surface, once, to the format that is fastest
+	 * to draw on the screen without changing what is drawn: opaque images
+	 * get the display format, images with only fully transparent and fully
+	 * opaque pixels get a color key and translucent images get premultiplied
+	 * alpha. Images cannot be converted before the video mode is set.
+	 * Returns the format of the surface after the conversion.
+	 */
+	Format convertForDisplay();
+
 private:
-	OffscreenSurface(SDL_Surface *raw) : Surface(raw) {}
+	bool convertToColorKey();
+
+	OffscreenSurface(SDL_Surface *raw, bool premultiplied = false)
+		: Surface(raw, premultiplied) {}
+
+	// For storing, recreating and packing surfaces.
+	friend class IconAtlas;
+	friend class ImageCache;
+	friend class SkinBundle;
 };
 
 /**
@@ -144,8 +230,38 @@ public:
 	 */
 	void flip();
 
+	/**
+	 * Returns the area that has to be repainted so that the screen shows
+	 * all changes in the given damaged area. This is larger than the damage
+	 * itself if the buffer to draw into lags behind: with double buffering
+	 * it also misses the previous frame's changes, and after a flip() of
+	 * the whole surface everything has to be repainted.
+	 * If the returned area is not empty, it must be repainted and then
+	 * passed to flip(SDL_Rect).
+	 */
+	SDL_Rect getRepaintArea(SDL_Rect const& damage);
+
+	/**
+	 * Presents the given area, as returned by getRepaintArea(), after it
+	 * was repainted. Nothing is presented if the area is empty.
+	 */
+	void flip(SDL_Rect const& area);
+
+	/**
+	 * Returns the number of times flip() presented the whole surface.
+	 * Such flips come from code that draws the whole screen by itself,
+	 * like the dialogs, which may also have changed what the layers show.
+	 */
+	unsigned int getFullFlipCount() const { return fullFlips; }
+
 private:
-	OutputSurface(SDL_Surface *raw) : Surface(raw) {}
+	OutputSurface(SDL_Surface *raw);
+
+	SDL_Rect screenRect() const;
+
+	/** Areas that the buffer to draw into and the other buffer are missing. */
+	SDL_Rect stale, staleOther;
+	unsigned int fullFlips = 0;
 };
 
 #endif
@@ -23,21 +23,125 @@
 #include "utilities.h"
 #include "debug.h"
 #include "gmenu2x.h"
+#ifdef ENABLE_INOTIFY
+#include "skinmonitor.h"
+#endif
 
+#include <algorithm>
+#include <condition_variable>
+#include <dirent.h>
 #include <iostream>
 
 using std::endl;
+using std::shared_ptr;
 using std::string;
+using std::unordered_map;
+using std::vector;
+
+/* Enough for the skin and the icons of a large collection of links. */
+static const size_t DEFAULT_BUDGET = 8 << 20;
+
+/* More threads than this would only compete for the SD card. */
+static const unsigned int MAX_WORKERS = 4;
+
+/* Returns the key of an image loaded with the given maximum size, which is
+ * used both in the collection and in the image cache. */
+static string sizedKey(const string &key, unsigned int maxSize) {
+	return maxSize ? key + "@" + std::to_string(maxSize) : key;
+}
 
 SurfaceCollection::SurfaceCollection()
-	: skin("default")
+	: budget(DEFAULT_BUDGET)
+	, residentBytes(0)
+	, imageCache(GMenu2X::getHome() + "/cache")
+	, skin("default")
+	, skinIndexStale(true)
+	, skinGeneration(1)
+	, workers(MAX_WORKERS)
 {
 }
 
 SurfaceCollection::~SurfaceCollection() {}
 
+void SurfaceCollection::pruneImageCache() {
+	workers.submit([this] { imageCache.prune(); });
+}
+
 void SurfaceCollection::setSkin(const string &skin) {
 	this->skin = skin;
+	indexSkinFiles();
+}
+
+/* Adds the files and directories below the given directory to the index,
+ * unless they are in the index already. */
+static void indexDirectory(unordered_map<string, string> &index,
+		const string &dir, const string &prefix, vector<string> &dirs)
+{
+	DIR *dirp = opendir(dir.c_str());
+	if (!dirp) return;
+	dirs.push_back(dir);
+
+	while (struct dirent *dptr = readdir(dirp)) {
+		if (dptr->d_name[0] == '.') continue;
+		const string name = prefix + dptr->d_name;
+		const string path = dir + '/' + dptr->d_name;
+		index.emplace(name, path);
+		if (dptr->d_type == DT_DIR) {
+			indexDirectory(index, path, name + '/', dirs);
+		}
+	}
+
+	closedir(dirp);
+}
+
+void SurfaceCollection::indexSkinFiles() {
+	skinIndexStale = false;
+	skinGeneration++;
+	skinFiles.clear();
+	defaultFiles.clear();
+
+	vector<string> dirs;
+	const string userSkins = GMenu2X::getHome() + "/skins/";
+	const string skinDirs[] = {
+		userSkins + skin, GMENU2X_SYSTEM_DIR "/skins/" + skin,
+		userSkins + "Default", GMENU2X_SYSTEM_DIR "/skins/Default",
+	};
+	indexDirectory(skinFiles, skinDirs[0], "", dirs);
+	indexDirectory(skinFiles, skinDirs[1], "", dirs);
+	// The Default skin would otherwise be indexed twice; a file it lacks
+	// is not found in defaultFiles either.
+	if (skin != "Default") {
+		indexDirectory(defaultFiles, skinDirs[2], "", dirs);
+		indexDirectory(defaultFiles, skinDirs[3], "", dirs);
+	}
+	DEBUG("Indexed %zu skin files and %zu default skin files in %zu directories\n",
+			skinFiles.size(), defaultFiles.size(), dirs.size());
+
+	// Reopened as well, since a bundle may have been (re)compiled.
+	skinBundles.clear();
+	for (size_t i = 0; i < 4; i++) {
+		if (i >= 2 && skin == "Default") {
+			break;
+		}
+		if (auto bundle = SkinBundle::open(skinDirs[i])) {
+			skinBundles.emplace_back(std::move(bundle));
+		}
+	}
+
+#ifdef ENABLE_INOTIFY
+	// The user's skins directory is watched as well, so that a new user
+	// skin directory is noticed.
+	dirs.push_back(GMenu2X::getHome() + "/skins");
+	std::sort(dirs.begin(), dirs.end());
+	dirs.erase(std::unique(dirs.begin(), dirs.end()), dirs.end());
+	// Keep watching if the directories are the same, as they are after most
+	// changes of the skin files.
+	if (!skinMonitor || dirs != watchedDirs) {
+		skinMonitor.reset();
+		watchedDirs = dirs;
+		skinMonitor.reset(new SkinMonitor(std::move(dirs), *this));
+	}
+#endif
 }
 
 /* Returns the location of a skin directory,
@@ -55,68 +159,95 @@ string SurfaceCollection::getSkinPath(const string &skin)
 	return "";
 }
 
+/* Looks up a file in a skin index, or the QOI version of a PNG image. */
+static string const* findSkinFile(unordered_map<string, string> const& index,
+		const string &file)
+{
+	auto it = index.find(file);
+	if (it == index.end() && file.size() > 4
+			&& file.compare(file.size() - 4, 4, ".png") == 0) {
+		it = index.find(file.substr(0, file.size() - 4) + ".qoi");
+	}
+	return it != index.end() ? &it->second : nullptr;
+}
+
 string SurfaceCollection::getSkinFilePath(const string &file, bool useDefault)
 {
-	/* We first search the skin file on the user-specific directory. */
-	string path = GMenu2X::getHome() + "/skins/" + skin + "/" + file;
-	if (fileExists(path))
-	  return path;
+	if (skinIndexStale)
+		indexSkinFiles();
 
-	/* If not found, we search that skin file on the system directory. */
-	path = GMENU2X_SYSTEM_DIR "/skins/" + skin + "/" + file;
-	if (fileExists(path))
-	  return path;
+	/* The user-specific directory overrides the system directory; this
+	 * is taken care of by the order of indexing. */
+	if (string const* path = findSkinFile(skinFiles, file))
+		return *path;
 
 	/* If it is nowhere to be found, as a last resort we check the
 	 * "Default" skin for a corresponding (but probably not similar) file. */
 	if (useDefault) {
-		path = GMenu2X::getHome() + "/skins/Default/" + file;
-		if (fileExists(path))
-		  return path;
-
-		path = GMENU2X_SYSTEM_DIR "/skins/Default/" + file;
-		if (fileExists(path))
-		  return path;
+		if (string const* path = findSkinFile(defaultFiles, file))
+			return *path;
 	}
 
 	return "";
 }
 
-void SurfaceCollection::debug() {
-	SurfaceHash::iterator end = surfaces.end();
-	for(SurfaceHash::iterator curr = surfaces.begin(); curr != end; curr++){
-		DEBUG("key: %s\n", curr->first.c_str());
+SkinBundle const* SurfaceCollection::getSkinBundle(const string &dir)
+{
+	if (skinIndexStale)
+		indexSkinFiles();
+
+	for (auto const& bundle : skinBundles) {
+		if (bundle->getDir() == dir)
+			return bundle.get();
 	}
+	return nullptr;
+}
+
+void SurfaceCollection::setBudget(size_t bytes) {
+	budget = bytes;
+	trim();
+}
+
+void SurfaceCollection::dump() {
+	for (auto it = lru.begin(); it != lru.end(); ++it) {
+		DEBUG("key: %s (%s, %zu bytes, %u hits, %ld refs)\n", it->c_str(),
+				OffscreenSurface::formatName(surfaces.at(*it).format),
+				surfaces.at(*it).bytes, surfaces.at(*it).hits,
+				surfaces.at(*it).surface.use_count() - 1);
+	}
+	DEBUG("%zu surfaces, %zu of %zu bytes resident, %zu assets interned, "
+			"%zu atlas pages\n", surfaces.size(), residentBytes, budget,
+			assets.size(), atlas.pageCount());
 }
 
 bool SurfaceCollection::exists(const string &path) {
 	return surfaces.find(path) != surfaces.end();
 }
 
-OffscreenSurface *SurfaceCollection::add(const string &path) {
+string SurfaceCollection::resolve(const string &path) {
+	if (path.substr(0,5)=="skin:") {
+		return getSkinFilePath(path.substr(5,path.length()));
+	} else if ((path.find('#') == path.npos) && (!fileExists(path))) {
+		WARNING("Unable to add image %s\n", path.c_str());
+		return "";
+	}
+	return path;
+}
+
+shared_ptr<OffscreenSurface> SurfaceCollection::add(const string &path, unsigned int maxSize) {
 	if (path.empty()) return NULL;
-	if (exists(path)) del(path);
-	string filePath = path;
+	const string key = sizedKey(path, maxSize);
+	if (exists(key)) del(key);
 
-	if (filePath.substr(0,5)=="skin:") {
-		filePath = getSkinFilePath(filePath.substr(5,filePath.length()));
-		if (filePath.empty())
-			return NULL;
-	} else if ((filePath.find('#') == filePath.npos) && (!fileExists(filePath))) {
-		WARNING("Unable to add image %s\n", path.c_str());
+	string filePath = resolve(path);
+	if (filePath.empty())
 		return NULL;
-	}
 
-	DEBUG("Adding surface: '%s'\n", path.c_str());
-	// TODO: Be safe.
-	auto s = OffscreenSurface::loadImage(filePath).release();
-	if (s) {
-		surfaces[path] = s;
-	}
-	return s;
+	DEBUG("Adding surface: '%s'\n", key.c_str());
+	return load(key, filePath, maxSize);
 }
 
-OffscreenSurface *SurfaceCollection::addSkinRes(const string &path, bool useDefault) {
+shared_ptr<OffscreenSurface> SurfaceCollection::addSkinRes(const string &path, bool useDefault) {
 	if (path.empty()) return NULL;
 	if (exists(path)) del(path);
 
@@ -125,48 +256,370 @@ OffscreenSurface *SurfaceCollection::addSkinRes(const string &path, bool useDefa
 		return NULL;
 
 	DEBUG("Adding skin surface: '%s'\n", path.c_str());
-	// TODO: Be safe.
-	auto s = OffscreenSurface::loadImage(skinpath).release();
-	if (s) {
-		surfaces[path] = s;
+	return load(path, skinpath);
+}
+
+shared_ptr<OffscreenSurface> SurfaceCollection::load(const string &key,
+		const string &filePath, unsigned int maxSize)
+{
+	Job job = Job();
+	job.key = key;
+	job.filePath = filePath;
+	job.maxSize = maxSize;
+	job.bundles = skinBundles;
+	fetch(job);
+	return publish(job);
+}
+
+void SurfaceCollection::fetch(Job &job) {
+	job.surface = imageCache.load(
+			sizedKey(job.filePath, job.maxSize), job.filePath, job.format);
+	job.cached = job.surface != nullptr;
+	if (!job.cached) {
+		job.surface = decode(job);
+	}
+}
+
+shared_ptr<OffscreenSurface> SurfaceCollection::publish(Job &job) {
+	shared_ptr<OffscreenSurface> s(job.surface.release());
+	if (!s) {
+		return s;
+	}
+	if (!job.cached) {
+		job.format = s->convertForDisplay();
+		imageCache.store(sizedKey(job.filePath, job.maxSize), job.filePath,
+				*s, job.format);
 	}
+	if (auto view = atlas.add(*s)) {
+		s = view;
+	}
+	const size_t bytes = s->byteSize();
+	DEBUG("Surface '%s' is stored in %s format, %zu bytes\n",
+			job.key.c_str(), OffscreenSurface::formatName(job.format), bytes);
+	lru.push_front(job.key);
+	surfaces[job.key] = { s, job.format, bytes, 0, lru.begin(), NO_ASSET };
+	residentBytes += bytes;
+	trim();
 	return s;
 }
 
+std::unique_ptr<OffscreenSurface> SurfaceCollection::decode(Job const& job)
+{
+	const unsigned int maxSize = job.maxSize;
+	for (auto const& bundle : job.bundles) {
+		if (auto s = bundle->loadImage(job.filePath)) {
+			// Bundles hold images at full size.
+			if (!maxSize || (s->width() <= (int) maxSize
+					&& s->height() <= (int) maxSize)) {
+				return s;
+			}
+			break;
+		}
+	}
+	return OffscreenSurface::loadImage(
+			job.filePath, true, true, maxSize, maxSize);
+}
+
+std::unique_ptr<OffscreenSurface> SurfaceCollection::loadDisplayFormat(const string &path) {
+	// Cached apart from the same image loaded by load().
+	const string key = path + "|display";
+	OffscreenSurface::Format format;
+	std::unique_ptr<OffscreenSurface> s = imageCache.load(key, path, format);
+	if (!s) {
+		s = OffscreenSurface::loadImageInDisplayFormat(path, true);
+		if (s) {
+			imageCache.store(key, path, *s, OffscreenSurface::Format::DISPLAY);
+		}
+	}
+	return s;
+}
+
+shared_ptr<OffscreenSurface> SurfaceCollection::lookup(const string &key) {
+	SurfaceHash::iterator i = surfaces.find(key);
+	if (i == surfaces.end()) {
+		return nullptr;
+	}
+	Entry &entry = i->second;
+	entry.hits++;
+	lru.splice(lru.begin(), lru, entry.lru);
+	return entry.surface;
+}
+
+void SurfaceCollection::trim() {
+	auto it = lru.end();
+	while (residentBytes > budget && it != lru.begin()) {
+		auto victim = std::prev(it);
+		SurfaceHash::iterator i = surfaces.find(*victim);
+		if (i->second.surface.use_count() > 1) {
+			it = victim;
+			continue;
+		}
+		DEBUG("Evicting surface: '%s'\n", victim->c_str());
+		erase(i);
+	}
+}
+
+void SurfaceCollection::erase(SurfaceHash::iterator i) {
+	Entry &entry = i->second;
+	if (entry.asset != NO_ASSET) {
+		assets[entry.asset].entry = nullptr;
+	}
+	residentBytes -= entry.bytes;
+	lru.erase(entry.lru);
+	surfaces.erase(i);
+}
+
 void SurfaceCollection::del(const string &path) {
 	SurfaceHash::iterator i = surfaces.find(path);
 	if (i != surfaces.end()) {
-		delete i->second;
-		surfaces.erase(i);
+		erase(i);
+	}
+	// Also drop the copies that were shrunk for an asset.
+	for (Asset &asset : assets) {
+		if (asset.entry && asset.maxSize && asset.key == path) {
+			erase(surfaces.find(asset.surfaceKey));
+		}
 	}
 
 	DEBUG("Unloading skin surface: '%s'\n", path.c_str());
 }
 
 void SurfaceCollection::clear() {
+	for (Asset &asset : assets) {
+		asset.entry = nullptr;
+	}
 	surfaces.clear();
+	lru.clear();
+	residentBytes = 0;
 }
 
 void SurfaceCollection::move(const string &from, const string &to) {
 	del(to);
-	surfaces[to] = surfaces[from];
-	surfaces.erase(from);
+	SurfaceHash::iterator i = surfaces.find(from);
+	if (i != surfaces.end()) {
+		Entry entry = i->second;
+		if (entry.asset != NO_ASSET) {
+			assets[entry.asset].entry = nullptr;
+			entry.asset = NO_ASSET;
+		}
+		surfaces.erase(i);
+		*entry.lru = to;
+		surfaces[to] = entry;
+	}
 }
 
-OffscreenSurface *SurfaceCollection::operator[](const string &key) {
-	SurfaceHash::iterator i = surfaces.find(key);
-	if (i == surfaces.end())
-		return add(key);
-	else
-		return i->second;
+shared_ptr<OffscreenSurface> SurfaceCollection::operator[](const string &key) {
+	shared_ptr<OffscreenSurface> s = lookup(key);
+	return s ? s : add(key);
 }
 
-OffscreenSurface *SurfaceCollection::skinRes(const string &key, bool useDefault) {
+shared_ptr<OffscreenSurface> SurfaceCollection::skinRes(const string &key, bool useDefault) {
 	if (key.empty()) return NULL;
 
-	SurfaceHash::iterator i = surfaces.find(key);
-	if (i == surfaces.end())
-		return addSkinRes(key, useDefault);
-	else
-		return i->second;
+	shared_ptr<OffscreenSurface> s = lookup(key);
+	return s ? s : addSkinRes(key, useDefault);
+}
+
+SurfaceCollection::AssetId SurfaceCollection::intern(const string &key, unsigned int maxSize) {
+	return intern(key, false, true, maxSize);
+}
+
+SurfaceCollection::AssetId SurfaceCollection::internSkinRes(const string &key, bool useDefault) {
+	return intern(key, true, useDefault, 0);
+}
+
+SurfaceCollection::AssetId SurfaceCollection::intern(const string &key,
+		bool skinRes, bool useDefault, unsigned int maxSize)
+{
+	const string surfaceKey = sizedKey(key, maxSize);
+	auto it = assetIds.find(surfaceKey);
+	if (it != assetIds.end()) {
+		return it->second;
+	}
+
+	const AssetId id = assets.size();
+	assets.push_back({ key, surfaceKey, skinRes, useDefault, maxSize,
+			nullptr, 0, false, false });
+	assetIds.emplace(surfaceKey, id);
+	return id;
+}
+
+shared_ptr<OffscreenSurface> SurfaceCollection::get(AssetId id) {
+	Asset &asset = assets[id];
+	if (asset.entry) {
+		asset.entry->hits++;
+		lru.splice(lru.begin(), lru, asset.entry->lru);
+		return asset.entry->surface;
+	}
+	if (asset.missing == skinGeneration && !skinIndexStale) {
+		return nullptr;
+	}
+
+	shared_ptr<OffscreenSurface> s;
+	if (asset.skinRes) {
+		s = skinRes(asset.key, asset.useDefault);
+	} else if (!(s = lookup(asset.surfaceKey))) {
+		s = add(asset.key, asset.maxSize);
+	}
+	attach(id, s != nullptr);
+	return s;
+}
+
+void SurfaceCollection::attach(AssetId id, bool loaded) {
+	Asset &asset = assets[id];
+	if (loaded) {
+		Entry &entry = surfaces.at(asset.surfaceKey);
+		entry.asset = id;
+		asset.entry = &entry;
+		asset.missing = 0;
+	} else {
+		asset.missing = skinGeneration;
+	}
+}
+
+void SurfaceCollection::preload(vector<AssetId> const& ids,
+		std::function<void()> meanwhile)
+{
+	// Decide what to load here: the skin index is not thread safe.
+	vector<Job> jobs;
+	vector<AssetId> jobAssets;
+	for (AssetId id : ids) {
+		Asset &asset = assets[id];
+		if (asset.entry || std::find(jobAssets.begin(), jobAssets.end(), id)
+				!= jobAssets.end()) {
+			continue;
+		}
+		if (exists(asset.surfaceKey) || (asset.missing == skinGeneration
+				&& !skinIndexStale)) {
+			get(id);
+			continue;
+		}
+		const string filePath = asset.skinRes
+				? getSkinFilePath(asset.key, asset.useDefault)
+				: resolve(asset.key);
+		if (filePath.empty()) {
+			attach(id, false);
+			continue;
+		}
+		Job job = Job();
+		job.key = asset.surfaceKey;
+		job.filePath = filePath;
+		job.maxSize = asset.maxSize;
+		job.bundles = skinBundles;
+		jobs.push_back(std::move(job));
+		jobAssets.push_back(id);
+	}
+	if (jobs.empty()) {
+		if (meanwhile) meanwhile();
+		return;
+	}
+	DEBUG("Preloading %zu surfaces on %u threads\n",
+			jobs.size(), workers.threadCount());
+
+	// Workers report the indices of the jobs they fetched. They notify
+	// while holding the lock, since this frame is gone once all are in.
+	std::mutex fetchedMutex;
+	std::condition_variable fetchedCond;
+	vector<size_t> fetched;
+	for (size_t i = 0; i < jobs.size(); i++) {
+		workers.submit([this, i, &jobs, &fetchedMutex, &fetchedCond, &fetched] {
+			fetch(jobs[i]);
+			std::lock_guard<std::mutex> lock(fetchedMutex);
+			fetched.push_back(i);
+			fetchedCond.notify_one();
+		});
+	}
+
+	if (meanwhile) meanwhile();
+
+	vector<size_t> ready;
+	for (size_t published = 0; published < jobs.size(); ) {
+		{
+			std::unique_lock<std::mutex> lock(fetchedMutex);
+			fetchedCond.wait(lock, [&fetched] { return !fetched.empty(); });
+			ready.swap(fetched);
+		}
+		for (size_t i : ready) {
+			attach(jobAssets[i], publish(jobs[i]) != nullptr);
+			published++;
+		}
+		ready.clear();
+	}
+}
+
+shared_ptr<OffscreenSurface> SurfaceCollection::request(AssetId id,
+		AssetId placeholder)
+{
+	Asset &asset = assets[id];
+	asset.cancelled = false;
+	if (asset.entry || exists(asset.surfaceKey)) {
+		return get(id);
+	}
+	if (!asset.pending && (asset.missing != skinGeneration || skinIndexStale)) {
+		const string filePath = asset.skinRes
+				? getSkinFilePath(asset.key, asset.useDefault)
+				: resolve(asset.key);
+		if (filePath.empty()) {
+			attach(id, false);
+		} else {
+			auto job = std::make_shared<Job>();
+			job->key = asset.surfaceKey;
+			job->filePath = filePath;
+			job->maxSize = asset.maxSize;
+			job->bundles = skinBundles;
+			job->asset = id;
+			job->generation = skinGeneration;
+			asset.pending = true;
+			workers.submit([this, job] {
+				fetch(*job);
+				bool first;
+				{
+					std::lock_guard<std::mutex> lock(loadedMutex);
+					first = loaded.empty();
+					loaded.push_back(job);
+				}
+				// One event for all jobs that finish before it is handled,
+				// so that a burst of them cannot fill the event queue.
+				if (first) {
+					inject_user_event(IMAGE_LOADED);
+				}
+			});
+		}
+	}
+	return placeholder != NO_ASSET ? get(placeholder) : nullptr;
+}
+
+void SurfaceCollection::cancelRequest(AssetId id) {
+	Asset &asset = assets[id];
+	asset.cancelled = asset.pending;
+}
+
+bool SurfaceCollection::storeLoaded() {
+	vector<shared_ptr<Job>> jobs;
+	{
+		std::lock_guard<std::mutex> lock(loadedMutex);
+		jobs.swap(loaded);
+	}
+	for (shared_ptr<Job> const& job : jobs) {
+		Asset &asset = assets[job->asset];
+		asset.pending = false;
+		if (asset.cancelled) {
+			asset.cancelled = false;
+			continue;
+		}
+		if (job->generation != skinGeneration) {
+			// The file may not be part of the current skin; it is
+			// requested again if it still is.
+			continue;
+		}
+		if (exists(job->key)) {
+			// Loaded by get() in the meantime.
+			if (!asset.entry) {
+				attach(job->asset, true);
+			}
+			continue;
+		}
+		attach(job->asset, publish(*job) != nullptr);
+	}
+	return !jobs.empty();
 }
@@ -20,44 +20,324 @@
 #ifndef SURFACECOLLECTION_H
 #define SURFACECOLLECTION_H
 
+#include "iconatlas.h"
+#include "imagecache.h"
+#include "skinbundle.h"
+#include "surface.h"
+#include "workerpool.h"
+
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
-class OffscreenSurface;
-class Surface;
-
-typedef std::unordered_map<std::string, OffscreenSurface *> SurfaceHash;
+class SkinMonitor;
 
 /**
 Hash Map of surfaces that loads surfaces not already loaded and reuses already loaded ones.
 
+Surfaces are handed out as shared pointers. Surfaces that are not referenced
+outside the collection are evicted, least recently used first, when the
+total size of the loaded surfaces exceeds the budget. Code that keeps a
+surface for later should therefore keep the pointer or look the surface up
+again, rather than keep a plain pointer.
+
 	@author Massimiliano Torromeo <massimiliano.torromeo@gmail.com>
 */
 class SurfaceCollection {
 public:
+	/**
+	 * Identifies a surface key, see intern(). IDs are small integers and stay
+	 * valid for the lifetime of the collection.
+	 */
+	typedef unsigned int AssetId;
+	/** An ID that refers to no asset. */
+	static const AssetId NO_ASSET = ~0U;
+
 	SurfaceCollection();
 	~SurfaceCollection();
 
 	void setSkin(const std::string &skin);
+	/**
+	 * Returns the full path of the given file of the current skin, or of
+	 * the Default skin if the current skin lacks it and useDefault is true,
+	 * or an empty string if there is no such file. A file in the user's
+	 * skin directory overrides the one in the system skin directory.
+	 * Lookups are answered from an index of the skin directories.
+	 * A skin may ship a PNG image as a QOI image, which loads faster: a
+	 * lookup of "name.png" finds "name.qoi" if there is no "name.png".
+	 */
 	std::string getSkinFilePath(const std::string &file, bool useDefault = true);
 	static std::string getSkinPath(const std::string &skin);
 
-	void debug();
+	/**
+	 * Returns the compiled bundle of the given skin directory, if it has one
+	 * and the directory belongs to the current or the Default skin.
+	 */
+	SkinBundle const* getSkinBundle(const std::string &dir);
+
+	/**
+	 * Makes the next lookup rebuild the index of the skin directories.
+	 * Must be called after adding, removing or renaming skin files, unless
+	 * the change is noticed through inotify. Can be called from any thread.
+	 */
+	void invalidateSkinIndex() { skinIndexStale = true; }
 
-	OffscreenSurface *addSkinRes(const std::string &path, bool useDefault = true);
+	/**
+	 * Sets the number of bytes the loaded surfaces may take, and evicts
+	 * surfaces if they take more. Surfaces in use are never evicted, so the
+	 * budget can be exceeded.
+	 */
+	void setBudget(size_t bytes);
+
+	/**
+	 * Logs all loaded surfaces with their format, size, number of lookups
+	 * and number of outside references, and the total size.
+	 */
+	void dump();
+
+	std::shared_ptr<OffscreenSurface> addSkinRes(const std::string &path, bool useDefault = true);
 	void     del(const std::string &path);
 	void     clear();
 	void     move(const std::string &from, const std::string &to);
 	bool     exists(const std::string &path);
 
-	OffscreenSurface *operator[](const std::string &);
-	OffscreenSurface *skinRes(const std::string &key, bool useDefault = true);
+	std::shared_ptr<OffscreenSurface> operator[](const std::string &);
+	std::shared_ptr<OffscreenSurface> skinRes(const std::string &key, bool useDefault = true);
+
+	/**
+	 * Loads an image to draw upon, such as the wallpaper, in the display
+	 * format, dithered if the display has less than 24-bit color. The image
+	 * is not kept in the collection, but it does go through the image
+	 * cache.
+	 */
+	std::unique_ptr<OffscreenSurface> loadDisplayFormat(const std::string &path);
+
+	/**
+	 * Removes the image cache files that can never be used again, on a
+	 * worker thread; see ImageCache::prune(). Since that scans the whole
+	 * cache, it is meant to be done once, at startup.
+	 */
+	void pruneImageCache();
+
+	/**
+	 * Returns the ID of the given key, which get() loads like operator[]
+	 * does. Interning the same key again returns the same ID; the first
+	 * call decides how the surface is loaded.
+	 * If maxSize is not zero, an image that is larger than a square of that
+	 * size is shrunk to fit while it is decoded. This suits icons, which are
+	 * drawn at a fixed size. Such a surface is kept apart from the one that
+	 * operator[] loads for the same key, so either has the expected size.
+	 */
+	AssetId intern(const std::string &key, unsigned int maxSize = 0);
+
+	/**
+	 * Returns the ID of the given key, which get() loads like skinRes()
+	 * does.
+	 */
+	AssetId internSkinRes(const std::string &key, bool useDefault = true);
+
+	/**
+	 * Returns the surface of the given ID, loading it if necessary.
+	 * While the surface stays loaded, this does no string handling or
+	 * hashing. A surface that could not be loaded is only retried when the
+	 * skin files change.
+	 */
+	std::shared_ptr<OffscreenSurface> get(AssetId id);
+
+	/**
+	 * Loads the surfaces of the given IDs that are not loaded yet, like
+	 * get() would, but decodes them concurrently on worker threads, so that
+	 * reading one image from storage overlaps decoding others. The calling
+	 * thread meanwhile runs the given function, if any, and then converts
+	 * and stores each image as soon as it is decoded. Returns once all
+	 * images are stored.
+	 * The function must not load surfaces into the collection, but it may
+	 * use loadDisplayFormat().
+	 */
+	void preload(std::vector<AssetId> const& ids,
+			std::function<void()> meanwhile = nullptr);
+
+	/**
+	 * Returns the surface of the given ID if it is loaded. If it is not,
+	 * queues it to be loaded on a worker thread and returns the surface of
+	 * the placeholder ID instead, or nullptr if that is NO_ASSET. The
+	 * placeholder itself is loaded like get() does.
+	 * This never decodes the requested image on the calling thread, so it
+	 * suits painting: when the image is decoded, an IMAGE_LOADED event is
+	 * sent and storeLoaded() makes it available.
+	 */
+	std::shared_ptr<OffscreenSurface> request(AssetId id,
+			AssetId placeholder = NO_ASSET);
+
+	/**
+	 * Makes storeLoaded() discard the image of the given ID, rather than
+	 * store it, if request() queued it and it is still being loaded. This
+	 * suits images that are no longer wanted, such as the previews of a
+	 * dialog that is closed. Requesting the image again undoes this.
+	 */
+	void cancelRequest(AssetId id);
+
+	/**
+	 * Stores the surfaces that were loaded on worker threads since the last
+	 * call. Returns true if there were any, in which case placeholders that
+	 * were drawn for them should be replaced.
+	 */
+	bool storeLoaded();
 
 private:
-	OffscreenSurface *add(const std::string &path);
+	struct Entry {
+		std::shared_ptr<OffscreenSurface> surface;
+		OffscreenSurface::Format format;
+		size_t bytes;
+		unsigned int hits;
+		/** Position in the LRU list. */
+		std::list<std::string>::iterator lru;
+		/** The asset that refers to this entry, if any. */
+		AssetId asset;
+	};
+	typedef std::unordered_map<std::string, Entry> SurfaceHash;
+
+	struct Asset {
+		std::string key;
+		/**
+		 * The key the surface is stored under: the key, followed by '@' and
+		 * the maximum size if there is one, since the surface depends on it.
+		 */
+		std::string surfaceKey;
+		bool skinRes, useDefault;
+		unsigned int maxSize;
+		/** The loaded surface, or nullptr if not loaded. */
+		Entry *entry;
+		/** The skin generation in which loading failed, or 0. */
+		unsigned int missing;
+		/** True while request() has it queued on a worker thread. */
+		bool pending;
+		/** True if the pending image is to be discarded; see cancelRequest(). */
+		bool cancelled;
+	};
+
+	/** An image to be loaded; see fetch() and publish(). */
+	struct Job {
+		std::string key, filePath;
+		unsigned int maxSize;
+		/** The asset and skin generation that request() queued this for. */
+		AssetId asset;
+		unsigned int generation;
+		/**
+		 * The skin bundles when the job was made. A worker reads these
+		 * rather than skinBundles, which the main thread replaces when it
+		 * indexes the skin files; the job keeps them mapped meanwhile.
+		 */
+		std::vector<std::shared_ptr<SkinBundle const>> bundles;
+		std::unique_ptr<OffscreenSurface> surface;
+		OffscreenSurface::Format format;
+		/** True if the surface came from the image cache, converted already. */
+		bool cached;
+	};
+
+	AssetId intern(const std::string &key, bool skinRes, bool useDefault,
+			unsigned int maxSize);
+
+	/**
+	 * Records in the given asset whether loading it succeeded; if it did, the
+	 * surface must be stored under the asset's key.
+	 */
+	void attach(AssetId id, bool loaded);
+
+	/**
+	 * Removes the given entry, forgetting about it in its asset.
+	 */
+	void erase(SurfaceHash::iterator i);
+
+	std::shared_ptr<OffscreenSurface> add(const std::string &path,
+			unsigned int maxSize = 0);
+
+	/**
+	 * Returns the file path of the image of the given key of operator[], or
+	 * an empty string if the file does not exist.
+	 */
+	std::string resolve(const std::string &path);
+
+	/**
+	 * Loads the image at the given file path, converts it for fast drawing
+	 * and stores it under the given key.
+	 */
+	std::shared_ptr<OffscreenSurface> load(const std::string &key,
+			const std::string &filePath, unsigned int maxSize = 0);
+
+	/**
+	 * Reads the image of a job from the image cache or decodes it.
+	 * This reads nothing but the files and skin bundles, so jobs can be
+	 * fetched on worker threads.
+	 */
+	void fetch(Job &job);
+
+	/**
+	 * Converts the fetched image of a job for fast drawing, unless it came
+	 * from the image cache, and stores it under its key. Only the main thread
+	 * stores surfaces, and only once they are complete.
+	 */
+	std::shared_ptr<OffscreenSurface> publish(Job &job);
+	/**
+	 * Decodes the image of a job with premultiplied alpha, from one of the
+	 * job's skin bundles if possible, else from its file.
+	 */
+	static std::unique_ptr<OffscreenSurface> decode(Job const& job);
+
+	/**
+	 * Returns the surface stored under the given key and marks it as most
+	 * recently used, or returns nullptr if there is no such surface.
+	 */
+	std::shared_ptr<OffscreenSurface> lookup(const std::string &key);
+
+	/**
+	 * Evicts unreferenced surfaces until the budget is met or there are
+	 * no unreferenced surfaces left.
+	 */
+	void trim();
+
+	/**
+	 * Indexes the files in the user and system directories of the current
+	 * skin and of the Default skin.
+	 */
+	void indexSkinFiles();
 
 	SurfaceHash surfaces;
+	/** Keys of the loaded surfaces, most recently used first. */
+	std::list<std::string> lru;
+	size_t budget, residentBytes;
+	ImageCache imageCache;
+	IconAtlas atlas;
 	std::string skin;
+
+	/** Full paths of skin files, by path relative to the skin directory. */
+	std::unordered_map<std::string, std::string> skinFiles, defaultFiles;
+	/** Compiled bundles of the indexed skin directories. */
+	std::vector<std::shared_ptr<SkinBundle const>> skinBundles;
+	std::atomic<bool> skinIndexStale;
+	/** Incremented when the skin files are indexed. */
+	unsigned int skinGeneration;
+
+	std::vector<Asset> assets;
+	std::unordered_map<std::string, AssetId> assetIds;
+
+	/** Jobs of request() that worker threads finished. */
+	std::vector<std::shared_ptr<Job>> loaded;
+	std::mutex loadedMutex;
+#ifdef ENABLE_INOTIFY
+	/** Watches watchedDirs, all from a single thread. */
+	std::unique_ptr<SkinMonitor> skinMonitor;
+	/** The directories of the indexed skin files, sorted. */
+	std::vector<std::string> watchedDirs;
+#endif
+
+	/** Destroyed first, since its tasks use the other members. */
+	WorkerPool workers;
 };
 
 #endif
@@ -54,7 +54,7 @@ void TextDialog::drawText(const vector<string> &text, unsigned int y,
 		}
 	}
 
-	gmenu2x->drawScrollBar(rowsPerPage, text.size(), firstRow);
+	gmenu2x->drawScrollBar(s, rowsPerPage, text.size(), firstRow);
 }
 
 void TextDialog::exec() {
@@ -29,6 +29,7 @@
 #include "utilities.h"
 
 #include <iostream>
+#include <set>
 
 using namespace std;
 
@@ -44,7 +45,7 @@ bool WallpaperDialog::exec()
 
 	FileLister fl;
 	fl.setShowDirectories(false);
-	fl.setFilter("png");
+	fl.setFilter("png,qoi");
 
 	fl.browse(GMenu2X::getHome() + "/skins/"
 		+ gmenu2x->confStr["skin"] + "/wallpapers", true);
@@ -72,16 +73,30 @@ bool WallpaperDialog::exec()
 	int fontheight = gmenu2x->font->getLineSpacing();
 	unsigned int nb_elements = height / fontheight;
 
+	set<SurfaceCollection::AssetId> requested;
+
 	while (!close) {
 		OutputSurface& s = *gmenu2x->s;
+		gmenu2x->sc.storeLoaded();
 
 		if (selected > firstElement + nb_elements - 1)
 			firstElement = selected - nb_elements + 1;
 		if (selected < firstElement)
 			firstElement = selected;
 
-		//Wallpaper
-		gmenu2x->sc[((string)"skin:wallpapers/" + wallpapers[selected]).c_str()]->blit(s, 0, 0);
+		//Wallpaper; until the selected one is decoded, the current one
+		//is shown, so that scrolling through the list does not stall.
+		shared_ptr<OffscreenSurface> preview;
+		if (!wallpapers.empty()) {
+			auto id = gmenu2x->sc.intern("skin:wallpapers/" + wallpapers[selected]);
+			requested.insert(id);
+			preview = gmenu2x->sc.request(id);
+		}
+		if (preview) {
+			preview->blit(s, 0, 0);
+		} else {
+			gmenu2x->bg->blit(s, 0, 0);
+		}
 
 		gmenu2x->drawTopBar(s);
 		gmenu2x->drawBottomBar(s);
@@ -108,7 +123,7 @@ bool WallpaperDialog::exec()
 		}
 		s.clearClipRect();
 
-		gmenu2x->drawScrollBar(nb_elements, wallpapers.size(), firstElement);
+		gmenu2x->drawScrollBar(s, nb_elements, wallpapers.size(), firstElement);
 		s.flip();
 
         switch(gmenu2x->input.waitForPressedButton()) {
@@ -146,6 +161,10 @@ bool WallpaperDialog::exec()
         }
 	}
 
+	// Previews that are still being decoded would otherwise be stored after
+	// the dialog is closed, pushing other surfaces out of the collection.
+	for (auto id : requested)
+	  gmenu2x->sc.cancelRequest(id);
 	for (uint i=0; i<wallpapers.size(); i++)
 	  gmenu2x->sc.del("skin:wallpapers/" + wallpapers[i]);
 
@@ -0,0 +1,61 @@
+// Various authors.
+// License: GPL version 2 or later.
+
+#include "workerpool.h"
+
+#include "debug.h"
+
+#include <algorithm>
+
+using namespace std;
+
+WorkerPool::WorkerPool(unsigned int maxThreads)
+	// hardware_concurrency() returns 0 if it does not know.
+	: numThreads(min(max(thread::hardware_concurrency(), 2u), maxThreads))
+	, stopping(false)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		lock_guard<mutex> lock(tasksMutex);
+		stopping = true;
+		tasks.clear();
+	}
+	wake.notify_all();
+	for (thread &t : threads) {
+		t.join();
+	}
+}
+
+void WorkerPool::submit(function<void()> task)
+{
+	{
+		lock_guard<mutex> lock(tasksMutex);
+		tasks.push_back(move(task));
+		if (threads.empty()) {
+			DEBUG("Starting %u worker threads\n", numThreads);
+			for (unsigned int i = 0; i < numThreads; i++) {
+				threads.emplace_back(&WorkerPool::run, this);
+			}
+		}
+	}
+	wake.notify_one();
+}
+
+void WorkerPool::run()
+{
+	unique_lock<mutex> lock(tasksMutex);
+	while (true) {
+		wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+		if (stopping) {
+			return;
+		}
+		function<void()> task = move(tasks.front());
+		tasks.pop_front();
+		lock.unlock();
+		task();
+		lock.lock();
+	}
+}
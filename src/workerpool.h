@@ -0,0 +1,49 @@
+// Various authors.
+// License: GPL version 2 or later.
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A few threads that run tasks in the background, such as decoding images
+ * while other images are read from the SD card.
+ *
+ * Tasks are started in the order they were submitted. A task must not
+ * touch state that the main thread uses without synchronization; it
+ * typically fills in a result that the submitter collects later.
+ * The threads are only started once the first task is submitted.
+ */
+class WorkerPool {
+public:
+	/**
+	 * Creates a pool of one thread per core, but at least 2 threads, so that
+	 * I/O and decoding overlap on a single core, and at most maxThreads.
+	 */
+	explicit WorkerPool(unsigned int maxThreads);
+
+	/** Discards the tasks that did not start yet and waits for the rest. */
+	~WorkerPool();
+
+	void submit(std::function<void()> task);
+
+	unsigned int threadCount() const { return numThreads; }
+
+private:
+	void run();
+
+	const unsigned int numThreads;
+	std::mutex tasksMutex;
+	std::condition_variable wake;
+	std::deque<std::function<void()>> tasks;
+	bool stopping;
+	std::vector<std::thread> threads;
+};
+
+#endif